@@ -10,6 +10,18 @@
 #define super IOHIDEventDriver
 OSDefineMetaClassAndStructors(AsusHIDDriver, IOHIDEventDriver);
 
+/**
+ *  AsusSMC messages, indexed by HIDRemapMessage
+ */
+static const UInt32 remapMessages[] = {
+    kSleep,
+    kAirplaneMode,
+    kTouchpadToggle,
+    kDisplayOff,
+};
+
+static_assert(sizeof(remapMessages) / sizeof(remapMessages[0]) == static_cast<size_t>(HIDRemapMessage::MessageCount), "remapMessages is out of sync with HIDRemapMessage");
+
 bool AsusHIDDriver::start(IOService *provider) {
     DBGLOG("hid", "start is called");
 
@@ -22,6 +34,8 @@ bool AsusHIDDriver::start(IOService *provider) {
     if (!hid_interface)
         return false;
 
+    loadUsageRemapOverrides();
+
     OSArray *elements = hid_interface->createMatchingElements();
     if (elements) parseCustomKeyboardElements(elements);
     OSSafeReleaseNULL(elements);
@@ -37,34 +51,154 @@ bool AsusHIDDriver::start(IOService *provider) {
     setProperty("AsusSMC-Build", "Release");
 #endif
 
+    featureReport = IOBufferMemoryDescriptor::withCapacity(KBD_FEATURE_REPORT_SIZE, kIODirectionInOut);
+    if (!featureReport) {
+        SYSLOG("hid", "Failed to allocate feature report buffer");
+        return false;
+    }
+
     asus_kbd_init();
 
+    backlightTimer = IOTimerEventSource::timerEventSource(this, [](OSObject *object, IOTimerEventSource *sender) {
+        auto hid = OSDynamicCast(AsusHIDDriver, object);
+        if (hid) hid->flushKeyboardBacklight();
+    });
+    if (!backlightTimer || getWorkLoop()->addEventSource(backlightTimer) != kIOReturnSuccess) {
+        SYSLOG("hid", "Failed to add backlight timer");
+        OSSafeReleaseNULL(backlightTimer);
+    }
+
+    if (!statPublisher.init(this, getWorkLoop(), [](OSObject *object, IOTimerEventSource *sender) {
+        auto hid = OSDynamicCast(AsusHIDDriver, object);
+        if (hid) hid->publishStatistics();
+    }))
+        SYSLOG("hid", "Failed to add statistics timer");
+    statPublisher.schedule();
+
     auto key = OSSymbol::withCString("AsusSMCCore");
     auto dict = propertyMatching(key, kOSBooleanTrue);
-    _asusSMC = IOService::waitForMatchingService(dict, 5000000000); // wait for 5 secs
+
+    IOServiceMatchingNotificationHandler handler = OSMemberFunctionCast(IOServiceMatchingNotificationHandler, this, &AsusHIDDriver::asusSMCHandler);
+
+    // Publish handler runs for an already published AsusSMC before addMatchingNotification returns,
+    // the terminate notifier has to be known by then
+    _smcTerminateNotify = addMatchingNotification(gIOTerminatedNotification, dict, handler, this);
+    _smcPublishNotify = addMatchingNotification(gIOFirstPublishNotification, dict, handler, this);
+
     key->release();
     dict->release();
 
-    if (_asusSMC) {
-        setProperty("KeyboardBacklightSupported", true);
-        _asusSMC->message(kAddAsusHIDDriver, this);
-        DBGLOG("hid", "Connected with AsusSMC");
-    }
+    return true;
+}
 
+bool AsusHIDDriver::asusSMCHandler(void *refCon, IOService *newService, IONotifier *notifier) {
+    getWorkLoop()->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &AsusHIDDriver::asusSMCHandlerGated), this, newService, notifier);
     return true;
 }
 
+void AsusHIDDriver::asusSMCHandlerGated(IOService *newService, IONotifier *notifier) {
+    if (notifier == _smcTerminateNotify) {
+        if (newService == _asusSMC) {
+            DBGLOG("hid", "AsusSMC terminated");
+            OSSafeReleaseNULL(_asusSMC);
+        }
+        return;
+    }
+
+    if (_asusSMC)
+        return;
+
+    newService->retain();
+    _asusSMC = newService;
+    setProperty("KeyboardBacklightSupported", true);
+    _asusSMC->message(kAddAsusHIDDriver, this);
+    DBGLOG("hid", "Connected with AsusSMC");
+}
+
 void AsusHIDDriver::stop(IOService *provider) {
     DBGLOG("hid", "stop is called");
+    if (_smcPublishNotify)
+        _smcPublishNotify->remove();
+    if (_smcTerminateNotify)
+        _smcTerminateNotify->remove();
+    _smcPublishNotify = nullptr;
+    _smcTerminateNotify = nullptr;
+
     if (_asusSMC) {
         _asusSMC->message(kDelAsusHIDDriver, this);
         DBGLOG("hid", "Disconnected with AsusSMC");
     }
     OSSafeReleaseNULL(_asusSMC);
+    if (backlightTimer) {
+        backlightTimer->cancelTimeout();
+        getWorkLoop()->removeEventSource(backlightTimer);
+        OSSafeReleaseNULL(backlightTimer);
+    }
+    statPublisher.deinit(getWorkLoop());
     hid_interface = nullptr;
     super::stop(provider);
 }
 
+void AsusHIDDriver::free() {
+    if (customElementsByReport)
+        IOFree(customElementsByReport, customElementCount * sizeof(IOHIDElement *));
+    customElementsByReport = nullptr;
+    OSSafeReleaseNULL(customKeyboardElements);
+    OSSafeReleaseNULL(featureReport);
+    super::free();
+}
+
+void AsusHIDDriver::publishStatistics() {
+    statPublisher.published();
+
+    const StatCounter counters[] = {
+        {"FastPath", atomic_load_explicit(&fastPathReports, memory_order_relaxed)},
+        {"SlowPath", atomic_load_explicit(&slowPathReports, memory_order_relaxed)},
+    };
+    publishCounters(this, "InterruptReportStatistics", counters);
+}
+
+void AsusHIDDriver::loadUsageRemapOverrides() {
+    OSArray *overrides = OSDynamicCast(OSArray, getProperty("UsageRemap"));
+    if (!overrides)
+        return;
+
+    for (unsigned int i = 0; i < overrides->getCount(); i++) {
+        OSDictionary *entry = OSDynamicCast(OSDictionary, overrides->getObject(i));
+        if (!entry)
+            continue;
+
+        OSNumber *page = OSDynamicCast(OSNumber, entry->getObject("Page"));
+        OSNumber *usage = OSDynamicCast(OSNumber, entry->getObject("Usage"));
+        if (!page || !usage || hidRemapPageIndex(page->unsigned32BitValue()) < 0 || usage->unsigned32BitValue() >= HIDRemapUsageCount) {
+            SYSLOG("hid", "Invalid UsageRemap entry %u", i);
+            continue;
+        }
+
+        HIDRemapEntry remap;
+        remap.accept = true;
+        remap.kind = HIDRemapKind::Drop;
+
+        OSNumber *targetPage = OSDynamicCast(OSNumber, entry->getObject("TargetPage"));
+        OSNumber *targetUsage = OSDynamicCast(OSNumber, entry->getObject("TargetUsage"));
+        OSString *message = OSDynamicCast(OSString, entry->getObject("Message"));
+        if (targetPage && targetUsage) {
+            remap.kind = HIDRemapKind::Remap;
+            remap.targetPage = targetPage->unsigned16BitValue();
+            remap.targetUsage = targetUsage->unsigned16BitValue();
+        } else if (message) {
+            if (!hidRemapMessageFromName(message->getCStringNoCopy(), remap.message)) {
+                SYSLOG("hid", "Unknown message %s in UsageRemap", message->getCStringNoCopy());
+                continue;
+            }
+            remap.kind = HIDRemapKind::Message;
+        }
+
+        usageRemap.entries[hidRemapPageIndex(page->unsigned32BitValue())][usage->unsigned32BitValue()] = remap;
+        DBGLOG("hid", "Remapped usagePage=0x%x usage=0x%x kind=%d", page->unsigned32BitValue(), usage->unsigned32BitValue(), static_cast<int>(remap.kind));
+    }
+}
+
 void AsusHIDDriver::parseCustomKeyboardElements(OSArray *elementArray) {
     customKeyboardElements = OSArray::withCapacity(4);
     UInt32 count, index;
@@ -75,63 +209,64 @@ void AsusHIDDriver::parseCustomKeyboardElements(OSArray *elementArray) {
         if (element->getType() == kIOHIDElementTypeCollection)
             continue;
 
-        UInt32 usagePage = element->getUsagePage();
-        UInt32 usage     = element->getUsage();
-        bool   store     = false;
-
-        switch (usagePage) {
-            case kHIDPage_AsusVendor:
-                switch (usage) {
-                    case kHIDUsage_AsusVendor_BrightnessDown:
-                    case kHIDUsage_AsusVendor_BrightnessUp:
-                    case kHIDUsage_AsusVendor_DisplayOff:
-                    case kHIDUsage_AsusVendor_ROG:
-                    case kHIDUsage_AsusVendor_Power4Gear:
-                    case kHIDUsage_AsusVendor_TouchpadToggle:
-                    case kHIDUsage_AsusVendor_Sleep:
-                    case kHIDUsage_AsusVendor_MicMute:
-                    case kHIDUsage_AsusVendor_Camera:
-                    case kHIDUsage_AsusVendor_RFKill:
-                    case kHIDUsage_AsusVendor_Fan:
-                    case kHIDUsage_AsusVendor_Calc:
-                    case kHIDUsage_AsusVendor_Splendid:
-                    case kHIDUsage_AsusVendor_IlluminationUp:
-                    case kHIDUsage_AsusVendor_IlluminationDown:
-                        store = true;
-                        break;
-                }
-                break;
-            case kHIDPage_MicrosoftVendor:
-                switch (usage) {
-                    case kHIDUsage_MicrosoftVendor_WLAN:
-                    case kHIDUsage_MicrosoftVendor_BrightnessDown:
-                    case kHIDUsage_MicrosoftVendor_BrightnessUp:
-                    case kHIDUsage_MicrosoftVendor_DisplayOff:
-                    case kHIDUsage_MicrosoftVendor_Camera:
-                    case kHIDUsage_MicrosoftVendor_ROG:
-                        store = true;
-                        break;
-                }
-                break;
-        }
-        if (store)
+        const HIDRemapEntry *remap = usageRemap.lookup(element->getUsagePage(), element->getUsage());
+        if (remap && remap->accept)
             customKeyboardElements->setObject(element);
     }
     setProperty("CustomKeyboardElements", customKeyboardElements);
+    buildCustomElementIndex();
+}
+
+void AsusHIDDriver::buildCustomElementIndex() {
+    UInt32 count = customKeyboardElements ? customKeyboardElements->getCount() : 0;
+    if (!count)
+        return;
+
+    customElementsByReport = static_cast<IOHIDElement **>(IOMalloc(count * sizeof(IOHIDElement *)));
+    if (!customElementsByReport) {
+        SYSLOG("hid", "Failed to allocate custom element index");
+        return;
+    }
+    customElementCount = count;
+
+    // Counting sort by report ID
+    UInt32 index;
+    for (index = 0; index < count; index++) {
+        IOHIDElement *element = static_cast<IOHIDElement *>(customKeyboardElements->getObject(index));
+        UInt32 reportID = element->getReportID();
+        if (reportID < MaxReportID)
+            customElementStart[reportID + 1]++;
+    }
+    for (index = 0; index < MaxReportID; index++)
+        customElementStart[index + 1] += customElementStart[index];
+
+    UInt16 next[MaxReportID];
+    lilu_os_memcpy(next, customElementStart, sizeof(next));
+    for (index = 0; index < count; index++) {
+        IOHIDElement *element = static_cast<IOHIDElement *>(customKeyboardElements->getObject(index));
+        UInt32 reportID = element->getReportID();
+        if (reportID < MaxReportID)
+            customElementsByReport[next[reportID]++] = element;
+    }
 }
 
 void AsusHIDDriver::handleInterruptReport(AbsoluteTime timeStamp, IOMemoryDescriptor *report, IOHIDReportType reportType, UInt32 reportID) {
+    if (reportID >= MaxReportID || customElementStart[reportID] == customElementStart[reportID + 1]) {
+        atomic_fetch_add_explicit(&fastPathReports, 1, memory_order_relaxed);
+        statPublisher.schedule();
+        super::handleInterruptReport(timeStamp, report, reportType, reportID);
+        return;
+    }
+
+    atomic_fetch_add_explicit(&slowPathReports, 1, memory_order_relaxed);
+    statPublisher.schedule();
     DBGLOG("hid", "handleInterruptReport reportLength=%d reportType=%d reportID=%d", report->getLength(), reportType, reportID);
-    UInt32 index, count;
-    for (index = 0, count = customKeyboardElements->getCount(); index < count; index++) {
-        IOHIDElement *element;
+    UInt32 index, end;
+    for (index = customElementStart[reportID], end = customElementStart[reportID + 1]; index < end; index++) {
+        IOHIDElement *element = customElementsByReport[index];
         AbsoluteTime  elementTimeStamp;
         UInt32        usagePage, usage, value, preValue;
 
-        element = OSDynamicCast(IOHIDElement, customKeyboardElements->getObject(index));
-        if (!element || element->getReportID() != reportID)
-            continue;
-
         elementTimeStamp = element->getTimeStamp();
         if (CMP_ABSOLUTETIME(&timeStamp, &elementTimeStamp) != 0)
             continue;
@@ -153,62 +288,68 @@ void AsusHIDDriver::handleInterruptReport(AbsoluteTime timeStamp, IOMemoryDescri
 
 void AsusHIDDriver::dispatchKeyboardEvent(AbsoluteTime timeStamp, UInt32 usagePage, UInt32 usage, UInt32 value, IOOptionBits options) {
     DBGLOG("hid", "dispatchKeyboardEvent usagePage=%d usage=%d", usagePage, usage);
-    if (usagePage == kHIDPage_AsusVendor) {
-        switch (usage) {
-            case kHIDUsage_AsusVendor_BrightnessDown:
-                usagePage = kHIDPage_AppleVendorTopCase;
-                usage = kHIDUsage_AV_TopCase_BrightnessDown;
+    if (const HIDRemapEntry *remap = usageRemap.lookup(usagePage, usage)) {
+        switch (remap->kind) {
+            case HIDRemapKind::Pass:
                 break;
-            case kHIDUsage_AsusVendor_BrightnessUp:
-                usagePage = kHIDPage_AppleVendorTopCase;
-                usage = kHIDUsage_AV_TopCase_BrightnessUp;
-                break;
-            case kHIDUsage_AsusVendor_IlluminationUp:
-                usagePage = kHIDPage_AppleVendorTopCase;
-                usage = kHIDUsage_AV_TopCase_IlluminationUp;
-                break;
-            case kHIDUsage_AsusVendor_IlluminationDown:
-                usagePage = kHIDPage_AppleVendorTopCase;
-                usage = kHIDUsage_AV_TopCase_IlluminationDown;
-                break;
-            case kHIDUsage_AsusVendor_Sleep:
-                if (value && _asusSMC) _asusSMC->message(kSleep, this);
-                return;
-            case kHIDUsage_AsusVendor_TouchpadToggle:
-                if (value && _asusSMC) _asusSMC->message(kTouchpadToggle, this);
-                return;
-            case kHIDUsage_AsusVendor_DisplayOff:
-                if (value && _asusSMC) _asusSMC->message(kDisplayOff, this);
+            case HIDRemapKind::Drop:
                 return;
-            default:
-                return;
-        }
-    }
-    if (usagePage == kHIDPage_MicrosoftVendor) {
-        switch (usage) {
-            case kHIDUsage_MicrosoftVendor_WLAN:
-                if (value && _asusSMC) _asusSMC->message(kAirplaneMode, this);
-                return;
-            case kHIDUsage_MicrosoftVendor_BrightnessDown:
-                usagePage = kHIDPage_AppleVendorTopCase;
-                usage = kHIDUsage_AV_TopCase_BrightnessDown;
-                break;
-            case kHIDUsage_MicrosoftVendor_BrightnessUp:
-                usagePage = kHIDPage_AppleVendorTopCase;
-                usage = kHIDUsage_AV_TopCase_BrightnessUp;
+            case HIDRemapKind::Remap:
+                usagePage = remap->targetPage;
+                usage = remap->targetUsage;
                 break;
-            case kHIDUsage_MicrosoftVendor_DisplayOff:
-                if (value && _asusSMC) _asusSMC->message(kDisplayOff, this);
+            case HIDRemapKind::Message:
+                if (value && _asusSMC) _asusSMC->message(remapMessages[static_cast<uint8_t>(remap->message)], this);
                 return;
-            default:
-                break;
         }
     }
+    notifyKeyPress(timeStamp, usagePage, usage, value);
     super::dispatchKeyboardEvent(timeStamp, usagePage, usage, value, options);
 }
 
+void AsusHIDDriver::notifyKeyPress(AbsoluteTime timeStamp, UInt32 usagePage, UInt32 usage, UInt32 value) {
+    if (!_asusSMC || !isTypingKeyPress(usagePage, usage, value))
+        return;
+
+    uint64_t now;
+    absolutetime_to_nanoseconds(AbsoluteTime_to_scalar(&timeStamp), &now);
+    if (keyPressLimiter.admit(now))
+        _asusSMC->message(kKeyPressed, this, &now);
+}
+
 void AsusHIDDriver::setKeyboardBacklight(uint8_t val) {
-    asus_kbd_backlight_set(val / 64);
+    atomic_store_explicit(&backlightLevel, skbvToHIDLevel(val), memory_order_release);
+
+    if (!backlightTimer) {
+        flushKeyboardBacklight();
+        return;
+    }
+
+    // Arm the timer once per burst, later writes only update the level
+    if (!atomic_exchange_explicit(&backlightPending, true, memory_order_acq_rel))
+        backlightTimer->setTimeoutMS(BacklightCoalesceMS);
+}
+
+void AsusHIDDriver::flushKeyboardBacklight() {
+    atomic_store_explicit(&backlightPending, false, memory_order_release);
+    uint8_t val = atomic_load_explicit(&backlightLevel, memory_order_acquire);
+    if (val == lastBacklightLevel)
+        return;
+
+    // A failed report leaves the last level alone so the next flush retries it
+    if (asus_kbd_backlight_set(val) == kIOReturnSuccess)
+        lastBacklightLevel = val;
+    else
+        SYSLOG("hid", "Failed to set keyboard backlight %d", val);
+}
+
+IOReturn AsusHIDDriver::setFeatureReport(const uint8_t *buf) {
+    if (!featureReport || !hid_interface)
+        return kIOReturnNotReady;
+
+    lilu_os_memcpy(featureReport->getBytesNoCopy(), buf, KBD_FEATURE_REPORT_SIZE);
+    featureReport->setLength(KBD_FEATURE_REPORT_SIZE);
+    return hid_interface->setReport(featureReport, kIOHIDReportTypeFeature, KBD_FEATURE_REPORT_ID);
 }
 
 #pragma mark -
@@ -216,34 +357,23 @@ void AsusHIDDriver::setKeyboardBacklight(uint8_t val) {
 #pragma mark -
 
 void AsusHIDDriver::asus_kbd_init() {
-    uint8_t buf[] = { KBD_FEATURE_REPORT_ID, 0x41, 0x53, 0x55, 0x53, 0x20, 0x54, 0x65, 0x63, 0x68, 0x2e, 0x49, 0x6e, 0x63, 0x2e, 0x00 };
-    OSData* dat = OSData::withBytes(buf, KBD_FEATURE_REPORT_SIZE);
-    IOBufferMemoryDescriptor* report = IOBufferMemoryDescriptor::withBytes(dat->getBytesNoCopy(0, KBD_FEATURE_REPORT_SIZE), dat->getLength(), kIODirectionInOut);
-    hid_interface->setReport(report, kIOHIDReportTypeFeature, KBD_FEATURE_REPORT_ID);
-    dat->release();
-    report->release();
+    const uint8_t buf[] = { KBD_FEATURE_REPORT_ID, 0x41, 0x53, 0x55, 0x53, 0x20, 0x54, 0x65, 0x63, 0x68, 0x2e, 0x49, 0x6e, 0x63, 0x2e, 0x00 };
+    setFeatureReport(buf);
 }
 
-void AsusHIDDriver::asus_kbd_backlight_set(uint8_t val) {
+IOReturn AsusHIDDriver::asus_kbd_backlight_set(uint8_t val) {
     DBGLOG("hid", "asus_kbd_backlight_set val=%d", val);
     uint8_t buf[] = { KBD_FEATURE_REPORT_ID, 0xba, 0xc5, 0xc4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
     buf[4] = val;
-    OSData* dat = OSData::withBytes(buf, KBD_FEATURE_REPORT_SIZE);
-    IOBufferMemoryDescriptor* report = IOBufferMemoryDescriptor::withBytes(dat->getBytesNoCopy(0, KBD_FEATURE_REPORT_SIZE), dat->getLength(), kIODirectionInOut);
-    hid_interface->setReport(report, kIOHIDReportTypeFeature, KBD_FEATURE_REPORT_ID);
-    dat->release();
-    report->release();
+    return setFeatureReport(buf);
 }
 
 void AsusHIDDriver::asus_kbd_get_functions(uint8_t *kbd_func) {
-    uint8_t buf[] = { KBD_FEATURE_REPORT_ID, 0x05, 0x20, 0x31, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
-    OSData* dat = OSData::withBytes(buf, KBD_FEATURE_REPORT_SIZE);
-    IOBufferMemoryDescriptor* report = IOBufferMemoryDescriptor::withBytes(dat->getBytesNoCopy(0, KBD_FEATURE_REPORT_SIZE), dat->getLength(), kIODirectionInOut);
-    hid_interface->setReport(report, kIOHIDReportTypeFeature, KBD_FEATURE_REPORT_ID);
-    hid_interface->getReport(report, kIOHIDReportTypeFeature, KBD_FEATURE_REPORT_ID);
+    const uint8_t buf[] = { KBD_FEATURE_REPORT_ID, 0x05, 0x20, 0x31, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    if (setFeatureReport(buf) != kIOReturnSuccess)
+        return;
+    hid_interface->getReport(featureReport, kIOHIDReportTypeFeature, KBD_FEATURE_REPORT_ID);
     uint8_t readbuf[KBD_FEATURE_REPORT_SIZE] = {};
-    report->readBytes(0, &readbuf, KBD_FEATURE_REPORT_SIZE);
+    featureReport->readBytes(0, &readbuf, KBD_FEATURE_REPORT_SIZE);
     *kbd_func = readbuf[6];
-    dat->release();
-    report->release();
 }
@@ -10,8 +10,13 @@
 
 #include <IOKit/hidevent/IOHIDEventDriver.h>
 #include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/IOTimerEventSource.h>
 #include <VirtualSMCSDK/kern_vsmcapi.hpp>
 #include "HIDUsageTables.h"
+#include "BacklightLevels.hpp"
+#include "HIDUsageRemap.hpp"
+#include "KeyPressFilter.hpp"
+#include "StatPublisher.hpp"
 
 #define KBD_FEATURE_REPORT_ID 0x5a
 #define KBD_FEATURE_REPORT_SIZE 16
@@ -31,6 +36,7 @@ enum {
     kAirplaneMode = iokit_vendor_specific_msg(204),
     kTouchpadToggle = iokit_vendor_specific_msg(205),
     kDisplayOff = iokit_vendor_specific_msg(206),
+    kKeyPressed = iokit_vendor_specific_msg(207), // data is uint64_t* key press timestamp in ns
 };
 
 class AsusHIDDriver : public IOHIDEventDriver {
@@ -39,23 +45,81 @@ class AsusHIDDriver : public IOHIDEventDriver {
 public:
     bool start(IOService *provider) override;
     void stop(IOService *provider) override;
+    void free() override;
     void handleInterruptReport(AbsoluteTime timeStamp, IOMemoryDescriptor *report, IOHIDReportType reportType, UInt32 reportID) override;
     void dispatchKeyboardEvent(AbsoluteTime timeStamp, UInt32 usagePage, UInt32 usage, UInt32 value, IOOptionBits options = 0) override;
 
     void setKeyboardBacklight(uint8_t val);
 
 private:
+    /**
+     *  AsusSMC core, attached through matching notifications so start never waits for it.
+     *  Only changed on the workloop, where reports are dispatched.
+     */
     IOService *_asusSMC {nullptr};
+    IONotifier *_smcPublishNotify {nullptr};
+    IONotifier *_smcTerminateNotify {nullptr};
+    bool asusSMCHandler(void *refCon, IOService *newService, IONotifier *notifier);
+    void asusSMCHandlerGated(IOService *newService, IONotifier *notifier);
+
     IOHIDInterface *hid_interface {nullptr};
 
     uint8_t kbd_func = 0;
 
+    /**
+     *  Key presses forwarded to AsusSMC
+     */
+    KeyPressLimiter keyPressLimiter;
+    void notifyKeyPress(AbsoluteTime timeStamp, UInt32 usagePage, UInt32 usage, UInt32 value);
+
+    /**
+     *  Vendor usage handling, defaults patched with UsageRemap
+     */
+    HIDRemapTable usageRemap {DefaultHIDRemapTable};
+    void loadUsageRemapOverrides();
+
     OSArray *customKeyboardElements {nullptr};
     void parseCustomKeyboardElements(OSArray *elementArray);
 
+    /**
+     *  Custom elements grouped by report ID, elements of report N are
+     *  customElementsByReport[customElementStart[N]...customElementStart[N + 1] - 1].
+     *  Elements are retained by customKeyboardElements.
+     */
+    static constexpr UInt32 MaxReportID {256};
+    IOHIDElement **customElementsByReport {nullptr};
+    UInt32 customElementCount {0};
+    UInt16 customElementStart[MaxReportID + 1] {};
+    void buildCustomElementIndex();
+
+    /**
+     *  Reports without custom elements go straight to IOHIDEventDriver
+     */
+    _Atomic(uint32_t) fastPathReports = ATOMIC_VAR_INIT(0);
+    _Atomic(uint32_t) slowPathReports = ATOMIC_VAR_INIT(0);
+
+    StatPublisher statPublisher;
+    void publishStatistics();
+
+    /**
+     *  Feature report buffer rewritten in place for every keyboard command
+     */
+    IOBufferMemoryDescriptor *featureReport {nullptr};
+    IOReturn setFeatureReport(const uint8_t *buf);
+
+    /**
+     *  Backlight writes are coalesced so only the latest level reaches the device
+     */
+    static constexpr uint32_t BacklightCoalesceMS {50};
+    IOTimerEventSource *backlightTimer {nullptr};
+    _Atomic(bool) backlightPending = ATOMIC_VAR_INIT(false);
+    _Atomic(uint8_t) backlightLevel = ATOMIC_VAR_INIT(0);
+    int lastBacklightLevel {-1}; // last level the device accepted
+    void flushKeyboardBacklight();
+
     // Ported from hid-asus driver
     void asus_kbd_init();
-    void asus_kbd_backlight_set(uint8_t val);
+    IOReturn asus_kbd_backlight_set(uint8_t val);
     void asus_kbd_get_functions(uint8_t *kbd_func);
 };
 #endif /* AsusHIDDriver_hpp */
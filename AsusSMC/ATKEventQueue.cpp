@@ -0,0 +1,62 @@
+//
+//  ATKEventQueue.cpp
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#include "ATKEventQueue.hpp"
+
+void ATKEventQueue::init() {
+    for (uint32_t i = 0; i < Capacity; i++)
+        atomic_init(&cells[i].sequence, i);
+    atomic_init(&enqueuePos, 0);
+    atomic_init(&dequeuePos, 0);
+}
+
+bool ATKEventQueue::push(uint32_t code, uint64_t timestamp) {
+    uint32_t pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+        cell = &cells[pos & (Capacity - 1)];
+        uint32_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        int32_t diff = static_cast<int32_t>(sequence - pos);
+        if (diff == 0) {
+            // Cell is free for this lap, claim it
+            if (atomic_compare_exchange_weak_explicit(&enqueuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // Consumer has not released the cell from the previous lap yet
+            atomic_fetch_add_explicit(&drops, 1, memory_order_relaxed);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+        }
+    }
+
+    cell->entry = {code, timestamp};
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+    uint32_t queued = pos + 1 - atomic_load_explicit(&dequeuePos, memory_order_relaxed);
+    uint32_t seen = atomic_load_explicit(&maxDepth, memory_order_relaxed);
+    while (queued > seen && !atomic_compare_exchange_weak_explicit(&maxDepth, &seen, queued, memory_order_relaxed, memory_order_relaxed));
+    return true;
+}
+
+bool ATKEventQueue::pop(Entry &entry) {
+    uint32_t pos = atomic_load_explicit(&dequeuePos, memory_order_relaxed);
+    Cell *cell = &cells[pos & (Capacity - 1)];
+    uint32_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    if (static_cast<int32_t>(sequence - (pos + 1)) < 0)
+        return false;
+
+    entry = cell->entry;
+    // Hand the cell to the producer of the next lap
+    atomic_store_explicit(&cell->sequence, pos + Capacity, memory_order_release);
+    atomic_store_explicit(&dequeuePos, pos + 1, memory_order_relaxed);
+    return true;
+}
+
+uint32_t ATKEventQueue::depth() const {
+    return atomic_load_explicit(&enqueuePos, memory_order_relaxed) - atomic_load_explicit(&dequeuePos, memory_order_relaxed);
+}
@@ -0,0 +1,71 @@
+//
+//  ATKEventQueue.hpp
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef ATKEventQueue_hpp
+#define ATKEventQueue_hpp
+
+#include <IOKit/IOLib.h>
+#include <VirtualSMCSDK/kern_vsmcapi.hpp>
+
+/**
+ *  Bounded lock-free queue of raw ATK notify codes.
+ *
+ *  Any number of producers (ACPI notification callouts) push, a single
+ *  consumer (the workloop) pops. Every cell carries a sequence number telling
+ *  whether it is free for the producer of this lap or filled for the consumer,
+ *  so push is a single compare-and-swap and never waits. A full queue drops
+ *  the code instead of blocking the notifier.
+ */
+class ATKEventQueue {
+public:
+    /**
+     *  Power of two so positions wrap with a mask
+     */
+    static constexpr uint32_t Capacity {32};
+
+    struct Entry {
+        uint32_t code;
+
+        /**
+         *  Uptime in ns when the notification arrived
+         */
+        uint64_t timestamp;
+    };
+
+    void init();
+
+    /**
+     *  Queue code, false if the queue is full and code was dropped
+     */
+    bool push(uint32_t code, uint64_t timestamp);
+
+    /**
+     *  Take the oldest entry, only called by the consumer
+     */
+    bool pop(Entry &entry);
+
+    uint32_t depth() const;
+    uint32_t maxDepthCount() const { return atomic_load_explicit(&maxDepth, memory_order_relaxed); }
+    uint32_t dropCount() const { return atomic_load_explicit(&drops, memory_order_relaxed); }
+
+private:
+    static_assert((Capacity & (Capacity - 1)) == 0, "ATKEventQueue capacity must be a power of two");
+
+    struct Cell {
+        _Atomic(uint32_t) sequence;
+        Entry entry;
+    };
+
+    Cell cells[Capacity] {};
+    _Atomic(uint32_t) enqueuePos = ATOMIC_VAR_INIT(0);
+    _Atomic(uint32_t) dequeuePos = ATOMIC_VAR_INIT(0);
+
+    _Atomic(uint32_t) maxDepth = ATOMIC_VAR_INIT(0);
+    _Atomic(uint32_t) drops = ATOMIC_VAR_INIT(0);
+};
+
+#endif /* ATKEventQueue_hpp */
@@ -21,6 +21,16 @@ OSDefineMetaClassAndStructors(AsusSMC, IOService)
 #define kIOPMPowerOff                       0
 #define kNumberOfStates                     2
 
+static uint64_t uptimeNS() {
+    uint64_t now;
+    absolutetime_to_nanoseconds(mach_absolute_time(), &now);
+    return now;
+}
+
+static uint64_t uptimeMS() {
+    return uptimeNS() / 1000000;
+}
+
 static IOPMPowerState powerStates[kNumberOfStates] = {
     {1, kIOPMPowerOff, kIOPMPowerOff, kIOPMPowerOff, 0, 0, 0, 0, 0, 0, 0, 0},
     {1, kIOPMPowerOn, kIOPMPowerOn, kIOPMPowerOn, 0, 0, 0, 0, 0, 0, 0, 0}
@@ -33,10 +43,15 @@ IOReturn AsusSMC::setPowerState(unsigned long powerStateOrdinal, IOService * wha
 
     if (powerStateOrdinal == 0) {
         DBGLOG("atk", "Power off");
-        setKBLLevel(0, false, false);
+        flushKBBacklightSave();
+        fadeKeyboardBacklight(0, true);
+    } else if (!kblCacheValid && !nvramEntry) {
+        DBGLOG("atk", "Waking up, NVRAM not published yet");
     } else {
         DBGLOG("atk", "Waking up");
-        kbl_level = readKBBacklightFromNVRAM();
+        // Stamped by the first SKBV write, the fade only starts here
+        atomic_store_explicit(&wakeRestoreBeginNS, uptimeNS(), memory_order_relaxed);
+        kbl_level = loadKBBacklightLevel();
         setKBLLevel(kbl_level, false, false);
     }
     return kIOPMAckImplied;
@@ -50,14 +65,20 @@ void AsusSMC::subscribePowerEvents(IOService *provider) {
 }
 
 bool AsusSMC::init(OSDictionary *dict) {
-    _notificationServices = OSSet::withCapacity(1);
-    _hidDrivers = OSSet::withCapacity(1);
+    hidDrivers.init();
 
-    kev.setVendorID("com.hieplpvip");
+    backlightDisplayLock = IOLockAlloc();
+
+    kev.init();
+
+    atkEventQueue.init();
+    kev.setVendorID(AsusSMCVendor);
     kev.setEventCode(AsusSMCEventCode);
 
     atomic_init(&currentLux, 0);
 
+    lilu_os_memcpy(atkEvents, DefaultATKEventTable.events, sizeof(atkEvents));
+
     bool result = super::init(dict);
     properties = dict;
 
@@ -99,42 +120,104 @@ bool AsusSMC::start(IOService *provider) {
         return false;
     }
 
-    atkDevice = (IOACPIPlatformDevice *) provider;
+    startupTimings.beginNS = uptimeNS();
 
-    OSNumber *arg = OSNumber::withNumber(1, 8);
-    atkDevice->evaluateObject("INIT", NULL, (OSObject**)&arg, 1);
-    arg->release();
+    atkDevice = (IOACPIPlatformDevice *) provider;
 
     SYSLOG("atk", "Found ATK Device %s", atkDevice->getName());
 
-    checkATK();
+    loadATKEventOverrides();
+
+    loadKeyboardBacklightFade();
+
+    loadPanelBrightnessSettings();
+
+    skbvArg = OSNumber::withNumber(0ULL, 8);
+
+    // Set up everything start can fail on before registering anything, so there is nothing to unwind.
+    // The virtual keyboard takes its workloop from us, so it has to exist first.
+    workloop = IOWorkLoop::workLoop();
+    command_gate = IOCommandGate::commandGate(this);
+    startupTimer = IOTimerEventSource::timerEventSource(this, [](OSObject *object, IOTimerEventSource *sender) {
+        auto self = OSDynamicCast(AsusSMC, object);
+        if (self) self->startATK();
+    });
+    if (!workloop || !command_gate || !startupTimer || workloop->addEventSource(command_gate) != kIOReturnSuccess) {
+        SYSLOG("atk", "Failed to create workloop");
+        OSSafeReleaseNULL(startupTimer);
+        OSSafeReleaseNULL(command_gate);
+        OSSafeReleaseNULL(workloop);
+        return false;
+    }
+    if (workloop->addEventSource(startupTimer) != kIOReturnSuccess) {
+        SYSLOG("atk", "Failed to add startup timer");
+        workloop->removeEventSource(command_gate);
+        OSSafeReleaseNULL(startupTimer);
+        OSSafeReleaseNULL(command_gate);
+        OSSafeReleaseNULL(workloop);
+        return false;
+    }
 
     initVirtualKeyboard();
 
+    notificationSource = IOInterruptEventSource::interruptEventSource(this, [](OSObject *object, IOInterruptEventSource *sender, int count) {
+        auto self = OSDynamicCast(AsusSMC, object);
+        if (self) self->deliverNotifications();
+    });
+    if (!notificationSource || workloop->addEventSource(notificationSource) != kIOReturnSuccess) {
+        SYSLOG("notify", "Failed to add notification event source");
+        OSSafeReleaseNULL(notificationSource);
+    }
+
+    atkEventSource = IOInterruptEventSource::interruptEventSource(this, [](OSObject *object, IOInterruptEventSource *sender, int count) {
+        auto self = OSDynamicCast(AsusSMC, object);
+        if (self) self->deliverATKEvents();
+    });
+    if (!atkEventSource || workloop->addEventSource(atkEventSource) != kIOReturnSuccess) {
+        SYSLOG("atk", "Failed to add ATK event source, handling notifications synchronously");
+        OSSafeReleaseNULL(atkEventSource);
+    }
+
+    // Consumer notifications are handled on the gate, so it has to exist first
     registerNotifications();
 
-    registerVSMC();
+    registerBacklightDisplayNotifications();
 
-    this->registerService(0);
+    nvramTimer = IOTimerEventSource::timerEventSource(this, [](OSObject *object, IOTimerEventSource *sender) {
+        auto self = OSDynamicCast(AsusSMC, object);
+        if (self) self->flushKBBacklightSave();
+    });
+    if (!nvramTimer || workloop->addEventSource(nvramTimer) != kIOReturnSuccess) {
+        SYSLOG("atk", "Failed to add NVRAM timer, saving synchronously");
+        OSSafeReleaseNULL(nvramTimer);
+    }
 
-    workloop = getWorkLoop();
-    if (!workloop) {
-        DBGLOG("atk", "Failed to get workloop");
-        return false;
+    brightnessTimer = IOTimerEventSource::timerEventSource(this, [](OSObject *object, IOTimerEventSource *sender) {
+        auto self = OSDynamicCast(AsusSMC, object);
+        if (self) self->applyPanelLevel();
+    });
+    if (!brightnessTimer || workloop->addEventSource(brightnessTimer) != kIOReturnSuccess) {
+        SYSLOG("atk", "Failed to add brightness timer, setting panel brightness synchronously");
+        OSSafeReleaseNULL(brightnessTimer);
     }
-    workloop->retain();
 
-    command_gate = IOCommandGate::commandGate(this);
-    if (!command_gate)
-        return false;
+    fadeTimer = IOTimerEventSource::timerEventSource(this, [](OSObject *object, IOTimerEventSource *sender) {
+        auto self = OSDynamicCast(AsusSMC, object);
+        if (self) self->stepKeyboardBacklightFade();
+    });
+    if (!fadeTimer || workloop->addEventSource(fadeTimer) != kIOReturnSuccess) {
+        SYSLOG("atk", "Failed to add fade timer, keyboard backlight will not fade");
+        OSSafeReleaseNULL(fadeTimer);
+    }
 
-    workloop->addEventSource(command_gate);
+    if (!statPublisher.init(this, workloop, [](OSObject *object, IOTimerEventSource *sender) {
+        auto self = OSDynamicCast(AsusSMC, object);
+        if (self) self->publishStatistics();
+    }))
+        SYSLOG("atk", "Failed to add statistics timer, statistics will not be published");
 
-    if (version_major > 18) { // Catalina and above
-        kbl_level = readKBBacklightFromNVRAM();
-        setKBLLevel(kbl_level);
+    if (version_major > 18) // Catalina and above
         subscribePowerEvents(provider);
-    }
 
     setProperty("AsusSMCCore", true);
     setProperty("IsTouchpadEnabled", true);
@@ -147,17 +230,96 @@ bool AsusSMC::start(IOService *provider) {
 #else
     setProperty("AsusSMC-Build", "Release");
 #endif
+
+    registerVSMC();
+
+    this->registerService(0);
+    startupTimings.publishUS = startupElapsedUS();
+    statPublisher.schedule();
+
+    // ATK and NVRAM may be slow, bring them up off the matching thread
+    startupTimer->setTimeoutMS(0);
+
     return true;
 }
 
 void AsusSMC::stop(IOService *provider) {
     DBGLOG("atk", "stop is called");
 
+    // Removing the timer waits for a running startATK, it cannot register NVRAM afterwards
+    if (startupTimer) {
+        startupTimer->cancelTimeout();
+        workloop->removeEventSource(startupTimer);
+        OSSafeReleaseNULL(startupTimer);
+    }
+
+    if (_nvramNotify)
+        _nvramNotify->remove();
+    _nvramNotify = nullptr;
+
     if (version_major > 18) { // Catalina and above
         DBGLOG("atk", "stop PM hook");
         PMstop();
     }
 
+    if (_publishNotify)
+        _publishNotify->remove();
+    if (_terminateNotify)
+        _terminateNotify->remove();
+    _publishNotify = nullptr;
+    _terminateNotify = nullptr;
+
+    if (_displayPublishNotify)
+        _displayPublishNotify->remove();
+    if (_displayTerminateNotify)
+        _displayTerminateNotify->remove();
+    _displayPublishNotify = nullptr;
+    _displayTerminateNotify = nullptr;
+    if (backlightDisplayLock) {
+        IOLockLock(backlightDisplayLock);
+        OSSafeReleaseNULL(backlightDisplay);
+        IOLockUnlock(backlightDisplayLock);
+    }
+
+    if (atkEventSource) {
+        atkEventSource->disable();
+        workloop->removeEventSource(atkEventSource);
+        OSSafeReleaseNULL(atkEventSource);
+    }
+
+    if (notificationSource) {
+        notificationSource->disable();
+        workloop->removeEventSource(notificationSource);
+        OSSafeReleaseNULL(notificationSource);
+    }
+    for (uint32_t i = 0; i < notificationConsumerCount; i++)
+        OSSafeReleaseNULL(notificationConsumers[i].service);
+    notificationConsumerCount = 0;
+
+    if (nvramTimer) {
+        nvramTimer->cancelTimeout();
+        workloop->removeEventSource(nvramTimer);
+        OSSafeReleaseNULL(nvramTimer);
+    }
+    flushKBBacklightSave();
+
+    if (brightnessTimer) {
+        brightnessTimer->cancelTimeout();
+        workloop->removeEventSource(brightnessTimer);
+        OSSafeReleaseNULL(brightnessTimer);
+    }
+
+    if (fadeTimer) {
+        fadeTimer->cancelTimeout();
+        workloop->removeEventSource(fadeTimer);
+        OSSafeReleaseNULL(fadeTimer);
+    }
+
+    // The keyboard runs its statistics timer on our workloop
+    deinitVirtualKeyboard();
+
+    statPublisher.deinit(workloop);
+
     if (poller)
         poller->cancelTimeout();
     if (workloop && poller)
@@ -168,21 +330,29 @@ void AsusSMC::stop(IOService *provider) {
     OSSafeReleaseNULL(poller);
     OSSafeReleaseNULL(command_gate);
 
-    _hidDrivers->flushCollection();
-    OSSafeReleaseNULL(_hidDrivers);
+    hidDrivers.removeAll();
 
-    _publishNotify->remove();
-    _terminateNotify->remove();
-    _notificationServices->flushCollection();
-    OSSafeReleaseNULL(_publishNotify);
-    OSSafeReleaseNULL(_terminateNotify);
-    OSSafeReleaseNULL(_notificationServices);
-    OSSafeReleaseNULL(_virtualKBrd);
+    OSSafeReleaseNULL(nvramEntry);
 
     super::stop(provider);
     return;
 }
 
+IOWorkLoop *AsusSMC::getWorkLoop() const {
+    return workloop;
+}
+
+void AsusSMC::free() {
+    kev.deinit();
+    hidDrivers.deinit();
+    if (backlightDisplayLock) {
+        IOLockFree(backlightDisplayLock);
+        backlightDisplayLock = nullptr;
+    }
+    OSSafeReleaseNULL(skbvArg);
+    super::free();
+}
+
 #pragma mark -
 #pragma mark AsusSMC Methods
 #pragma mark -
@@ -190,25 +360,23 @@ void AsusSMC::stop(IOService *provider) {
 IOReturn AsusSMC::message(UInt32 type, IOService *provider, void *argument) {
     switch (type) {
         case kIOACPIMessageDeviceNotification:
-            if (directACPImessaging) {
-                handleMessage(*((UInt32 *) argument));
+            if (!atkEventSource) {
+                handleMessage(readATKEventCode(*((UInt32 *) argument)));
+            } else if (atkEventQueue.push(*((UInt32 *) argument), uptimeNS())) {
+                atkEventSource->interruptOccurred(nullptr, nullptr, 0);
             } else {
-                UInt32 event = *((UInt32 *) argument);
-                OSNumber *arg = OSNumber::withNumber(event, sizeof(event) * 8);
-                UInt32 res;
-                atkDevice->evaluateInteger("_WED", &res, (OSObject**)&arg, 1);
-                arg->release();
-                handleMessage(res);
+                DBGLOG("atk", "ATK event queue full, dropped code 0x%x", *((UInt32 *) argument));
             }
             break;
         case kAddAsusHIDDriver:
             DBGLOG("atk", "Connected with HID driver");
             setProperty("HIDKeyboardExist", true);
-            _hidDrivers->setObject(provider);
+            if (!hidDrivers.add(OSDynamicCast(AsusHIDDriver, provider)))
+                SYSLOG("atk", "Failed to register HID driver %s", provider->getName());
             break;
         case kDelAsusHIDDriver:
             DBGLOG("atk", "Disconnected with HID driver");
-            _hidDrivers->removeObject(provider);
+            hidDrivers.remove(provider);
             break;
         case kSleep:
             letSleep();
@@ -222,6 +390,10 @@ IOReturn AsusSMC::message(UInt32 type, IOService *provider, void *argument) {
         case kDisplayOff:
             displayOff();
             break;
+        case kKeyPressed:
+            if (argument)
+                notifyKeyPress(*static_cast<uint64_t *>(argument));
+            break;
         default:
             DBGLOG("atk", "Unexpected message: %u Type %x Provider %s", *((UInt32 *) argument), uint(type), provider->getName());
             break;
@@ -229,77 +401,209 @@ IOReturn AsusSMC::message(UInt32 type, IOService *provider, void *argument) {
     return kIOReturnSuccess;
 }
 
-void AsusSMC::handleMessage(int code) {
-    // Processing the code
-    switch (code) {
-        case 0x57: // AC disconnected
-        case 0x58: // AC connected
-            // ignore silently
-            break;
+void AsusSMC::systemWillShutdown(IOOptionBits specifier) {
+    flushKBBacklightSave();
+    super::systemWillShutdown(specifier);
+}
 
-        case 0x30: // Volume up
-            dispatchCSMRReport(kHIDUsage_Csmr_VolumeIncrement);
-            break;
+void AsusSMC::publishStatistics() {
+    statPublisher.published();
+
+    if (hasALSensor) {
+        const StatCounter counters[] = {
+            {"Samples", alsSampler.sampleCount()},
+            {"SamplesPerMinute", alsSampler.samplesPerMinute()},
+            {"SampleIntervalMS", alsSampler.intervalMS()},
+            {"InterruptsPosted", alsSampler.interruptCount()},
+            {"InterruptsSuppressed", alsSampler.suppressedCount()},
+        };
+        publishCounters(this, "ALSStatistics", counters);
+    }
+    if (hasKeybrdBLight) {
+        const StatCounter counters[] = {
+            {"LastRestoreUS", wakeRestoreLastUS},
+            {"MaxRestoreUS", wakeRestoreMaxUS},
+            {"CacheHits", kblCacheHits},
+            {"CacheMisses", kblCacheMisses},
+        };
+        publishCounters(this, "WakeRestoreStatistics", counters);
+    }
+    if (version_major > 18) {
+        const StatCounter counters[] = {
+            {"WritesRequested", atomic_load_explicit(&nvramWritesRequested, memory_order_relaxed)},
+            {"WritesPerformed", atomic_load_explicit(&nvramWritesPerformed, memory_order_relaxed)},
+        };
+        publishCounters(this, "NVRAMStatistics", counters);
+    }
+    {
+        const StatCounter counters[] = {
+            {"KeyPressesSeen", atomic_load_explicit(&keyPressesSeen, memory_order_relaxed)},
+            {"KeyPressesNotified", atomic_load_explicit(&keyPressesNotified, memory_order_relaxed)},
+        };
+        publishCounters(this, "KeyPressStatistics", counters);
+    }
+    {
+        const StatCounter counters[] = {
+            {"LevelRequests", atomic_load_explicit(&panelLevelRequests, memory_order_relaxed)},
+            {"BrightnessSets", atomic_load_explicit(&panelBrightnessSets, memory_order_relaxed)},
+            {"KeystrokeFallbacks", atomic_load_explicit(&panelKeystrokeFallbacks, memory_order_relaxed)},
+        };
+        publishCounters(this, "PanelBrightnessStatistics", counters);
+    }
+    {
+        const StatCounter counters[] = {
+            {"Handled", atkEventsHandled},
+            {"QueueDepth", atkEventQueue.depth()},
+            {"MaxQueueDepth", atkEventQueue.maxDepthCount()},
+            {"Dropped", atkEventQueue.dropCount()},
+            {"LastQueueUS", atkQueueLastUS},
+            {"MaxQueueUS", atkQueueMaxUS},
+            {"MaxDecodeUS", atkDecodeMaxUS},
+            {"MaxHandleUS", atkHandleMaxUS},
+        };
+        publishCounters(this, "ATKEventStatistics", counters);
+    }
+    {
+        const StatCounter counters[] = {
+            {"PublishUS", startupTimings.publishUS},
+            {"ATKInitUS", startupTimings.atkInitUS},
+            {"ATKReadyUS", startupTimings.atkReadyUS},
+            {"NVRAMReadyUS", startupTimings.nvramReadyUS},
+            {"VirtualSMCReadyUS", startupTimings.vsmcReadyUS},
+        };
+        publishCounters(this, "StartupTimings", counters);
+    }
+    publishNotificationStatistics();
+}
 
-        case 0x31: // Volume down
-            dispatchCSMRReport(kHIDUsage_Csmr_VolumeDecrement);
-            break;
+void AsusSMC::loadATKEventOverrides() {
+    OSArray *overrides = OSDynamicCast(OSArray, getProperty("ATKEventMap"));
+    if (!overrides)
+        return;
 
-        case 0x32: // Mute
-            dispatchCSMRReport(kHIDUsage_Csmr_Mute);
-            break;
+    for (unsigned int i = 0; i < overrides->getCount(); i++) {
+        OSDictionary *entry = OSDynamicCast(OSDictionary, overrides->getObject(i));
+        if (!entry)
+            continue;
 
-        // Media buttons
-        case 0x40:
-        case 0x8A:
-            dispatchCSMRReport(kHIDUsage_Csmr_ScanPreviousTrack);
-            break;
+        OSNumber *code = OSDynamicCast(OSNumber, entry->getObject("Code"));
+        OSString *action = OSDynamicCast(OSString, entry->getObject("Action"));
+        if (!code || !action || code->unsigned32BitValue() >= ATKEventCount) {
+            SYSLOG("atk", "Invalid ATKEventMap entry %u", i);
+            continue;
+        }
 
-        case 0x41:
-        case 0x82:
-            dispatchCSMRReport(kHIDUsage_Csmr_ScanNextTrack);
-            break;
+        ATKEvent event;
+        if (!atkActionFromName(action->getCStringNoCopy(), event.action)) {
+            SYSLOG("atk", "Unknown action %s in ATKEventMap", action->getCStringNoCopy());
+            continue;
+        }
+        if (OSNumber *usage = OSDynamicCast(OSNumber, entry->getObject("Usage")))
+            event.usage = usage->unsigned16BitValue();
+        if (OSNumber *repeat = OSDynamicCast(OSNumber, entry->getObject("Repeat")))
+            event.repeat = repeat->unsigned8BitValue();
+
+        // Only brightness codes carry a level, other codes have to name it
+        if (event.action == ATKAction::PanelBrightness) {
+            OSNumber *level = OSDynamicCast(OSNumber, entry->getObject("Level"));
+            if (level && level->unsigned32BitValue() <= PanelATKMaxLevel) {
+                event.level = level->unsigned8BitValue();
+            } else if (!level && isATKBrightnessCode(code->unsigned32BitValue())) {
+                event.level = atkBrightnessLevel(code->unsigned32BitValue());
+            } else {
+                SYSLOG("atk", "ATKEventMap entry %u needs a Level 0...%u for PanelBrightness", i, PanelATKMaxLevel);
+                continue;
+            }
+        }
+
+        atkEvents[code->unsigned32BitValue()] = event;
+        DBGLOG("atk", "Mapped code 0x%x to %s usage 0x%x repeat %d", code->unsigned32BitValue(), action->getCStringNoCopy(), event.usage, event.repeat);
+    }
+}
+
+uint32_t AsusSMC::readATKEventCode(uint32_t event) {
+    if (directACPImessaging)
+        return event;
+
+    OSNumber *arg = OSNumber::withNumber(event, sizeof(event) * 8);
+    UInt32 res;
+    atkDevice->evaluateInteger("_WED", &res, (OSObject**)&arg, 1);
+    arg->release();
+    return res;
+}
+
+void AsusSMC::deliverATKEvents() {
+    ATKEventQueue::Entry entry;
+    while (atkEventQueue.pop(entry)) {
+        uint64_t dequeued = uptimeNS();
+        atkQueueLastUS = static_cast<uint32_t>((dequeued - entry.timestamp) / 1000);
+        if (atkQueueLastUS > atkQueueMaxUS)
+            atkQueueMaxUS = atkQueueLastUS;
+
+        uint32_t code = readATKEventCode(entry.code);
+        uint64_t decoded = uptimeNS();
+
+        handleMessage(code);
+        uint64_t handled = uptimeNS();
+
+        uint32_t decodeUS = static_cast<uint32_t>((decoded - dequeued) / 1000);
+        uint32_t handleUS = static_cast<uint32_t>((handled - decoded) / 1000);
+        if (decodeUS > atkDecodeMaxUS)
+            atkDecodeMaxUS = decodeUS;
+        if (handleUS > atkHandleMaxUS)
+            atkHandleMaxUS = handleUS;
+        atkEventsHandled++;
+    }
+    statPublisher.schedule();
+}
 
-        case 0x45:
-        case 0x5C:
-            dispatchCSMRReport(kHIDUsage_Csmr_PlayOrPause);
+void AsusSMC::handleMessage(int code) {
+    ATKEvent event = static_cast<uint32_t>(code) < ATKEventCount ? atkEvents[code] : ATKEvent {};
+
+    if (event.action != ATKAction::None && event.action != ATKAction::ALSNotify)
+        notifyKeyPress(uptimeNS());
+
+    switch (event.action) {
+        case ATKAction::ConsumerKey:
+            dispatchCSMRReport(event.usage, event.repeat);
             break;
 
-        case 0x33: // hardwired On
-        case 0x34: // hardwired Off
-        case 0x35: // Soft Event, Fn + F7
-            displayOff();
+        case ATKAction::TopCaseKey:
+            dispatchTCReport(event.usage, event.repeat);
             break;
 
-        case 0x61: // Video Mirror
-            dispatchTCReport(kHIDUsage_AV_TopCase_VideoMirror);
+        case ATKAction::DisplayOff:
+            displayOff();
             break;
 
-        case 0x6B: // Fn + F9, Touchpad On/Off
+        case ATKAction::TouchpadToggle:
             toggleTouchpad();
             break;
 
-        case 0x5E:
+        case ATKAction::Sleep:
             letSleep();
             break;
 
-        case 0x7A: // Fn + A, ALS Sensor
+        case ATKAction::ALSToggle:
             if (hasALSensor) {
                 isALSenabled = !isALSenabled;
                 toggleALS(isALSenabled);
             }
             break;
 
-        case 0x7D: // Airplane mode
+        case ATKAction::AirplaneMode:
             toggleAirplaneMode();
             break;
 
-        case 0xC6:
-        case 0xC7: // ALS Notifcations
-            // ignore
+        case ATKAction::ALSNotify:
+            handleALSNotification();
+            break;
+
+        case ATKAction::PanelBrightness:
+            requestPanelLevel(event.level, event.usage);
             break;
 
-        case 0xC5: // Keyboard Backlight Down
+        case ATKAction::KeyboardBacklightDown:
             if (hasKeybrdBLight) {
                 if (version_major <= 18) dispatchTCReport(kHIDUsage_AV_TopCase_IlluminationDown);
                 else {
@@ -309,21 +613,18 @@ void AsusSMC::handleMessage(int code) {
             }
             break;
 
-        case 0xC4: // Keyboard Backlight Up
+        case ATKAction::KeyboardBacklightUp:
             if (hasKeybrdBLight) {
                 if (version_major <= 18) dispatchTCReport(kHIDUsage_AV_TopCase_IlluminationUp);
                 else {
-                    if (kbl_level < 16) ++kbl_level;
+                    if (kbl_level < KBLMaxLevel) ++kbl_level;
                     setKBLLevel(kbl_level, true);
                 }
             }
             break;
 
-        default:
-            if (code >= NOTIFY_BRIGHTNESS_DOWN_MIN && code<= NOTIFY_BRIGHTNESS_DOWN_MAX) // Brightness Down
-                dispatchTCReport(kHIDUsage_AV_TopCase_BrightnessDown);
-            else if (code >= NOTIFY_BRIGHTNESS_UP_MIN && code<= NOTIFY_BRIGHTNESS_UP_MAX) // Brightness Up
-                dispatchTCReport(kHIDUsage_AV_TopCase_BrightnessUp);
+        case ATKAction::None:
+        case ATKAction::ActionCount:
             break;
     }
 
@@ -343,13 +644,50 @@ void AsusSMC::saveKBBacklightToNVRAM(uint16_t val) {
     }
 }
 
-uint16_t AsusSMC::readKBBacklightFromNVRAM() {
-    uint16_t val = 16;
+void AsusSMC::requestKBBacklightSave(uint16_t val) {
+    atomic_fetch_add_explicit(&nvramWritesRequested, 1, memory_order_relaxed);
+    statPublisher.schedule();
+    atomic_store_explicit(&pendingKBLSave, val, memory_order_release);
 
-    OSDictionary* matching = serviceMatching("IODTNVRAM");
-    IORegistryEntry* nvram = waitForMatchingService(matching, 5000000000); // wait for 5 secs
-    matching->release();
+    // Every request restarts the quiet period, holding the key ends in a single write
+    if (nvramTimer)
+        nvramTimer->setTimeoutMS(NVRAMSaveQuietMS);
+    else
+        flushKBBacklightSave();
+}
 
+void AsusSMC::flushKBBacklightSave() {
+    int32_t val = atomic_exchange_explicit(&pendingKBLSave, -1, memory_order_acq_rel);
+    if (val < 0)
+        return;
+
+    saveKBBacklightToNVRAM(static_cast<uint16_t>(val));
+    atomic_fetch_add_explicit(&nvramWritesPerformed, 1, memory_order_relaxed);
+    statPublisher.schedule();
+    DBGLOG("atk", "Saved keyboard backlight level %d to NVRAM", val);
+}
+
+uint16_t AsusSMC::loadKBBacklightLevel() {
+    if (kblCacheValid) {
+        kblCacheHits++;
+        return kbl_level;
+    }
+
+    // Nothing to read yet, the NVRAM notification restores the level once it is published
+    if (!nvramEntry)
+        return kbl_level;
+
+    kblCacheMisses++;
+    statPublisher.schedule();
+    kbl_level = readKBBacklightFromNVRAM();
+    kblCacheValid = true;
+    return kbl_level;
+}
+
+uint16_t AsusSMC::readKBBacklightFromNVRAM() {
+    uint16_t val = KBLMaxLevel;
+
+    IORegistryEntry* nvram = nvramEntry;
     if (!nvram) SYSLOG("atk", "NVRAM not available");
     else {
         // need to serialize as getProperty on nvram does not work
@@ -367,18 +705,155 @@ uint16_t AsusSMC::readKBBacklightFromNVRAM() {
             }
             serial->release();
         }
-        nvram->release();
     }
     return val;
 }
 
-void AsusSMC::setKBLLevel(uint16_t val, bool badge, bool save) {
-    if (badge) kev.sendMessage(kevKeyboardBacklight, val, 16);
-    if (save) saveKBBacklightToNVRAM(val);
-    val = min(val * 16, 255);
-    OSNumber *arg = OSNumber::withNumber(val, sizeof(val) * 8);
-    atkDevice->evaluateObject("SKBV", NULL, (OSObject**)&arg, 1);
+void AsusSMC::registerNVRAMNotification() {
+    auto *nvramMatch = serviceMatching("IODTNVRAM");
+    if (!nvramMatch)
+        return;
+
+    _nvramNotify = addMatchingNotification(gIOFirstPublishNotification,
+                                           nvramMatch,
+                                           OSMemberFunctionCast(IOServiceMatchingNotificationHandler, this, &AsusSMC::nvramHandler),
+                                           this);
+    nvramMatch->release();
+}
+
+bool AsusSMC::nvramHandler(void *refCon, IOService *newService, IONotifier *notifier) {
+    // Fires inline from startATK when NVRAM is already up, the gate is recursive
+    command_gate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &AsusSMC::nvramPublishedGated), newService);
+    return true;
+}
+
+void AsusSMC::nvramPublishedGated(IOService *nvram) {
+    if (nvramEntry)
+        return;
+
+    nvram->retain();
+    nvramEntry = nvram;
+    DBGLOG("atk", "NVRAM published");
+
+    if (version_major > 18) { // Catalina and above
+        kbl_level = loadKBBacklightLevel();
+        setKBLLevel(kbl_level, false, false);
+    }
+    startupTimings.nvramReadyUS = startupElapsedUS();
+    statPublisher.schedule();
+}
+
+void AsusSMC::startATK() {
+    uint64_t begin = uptimeNS();
+
+    OSNumber *arg = OSNumber::withNumber(1, 8);
+    atkDevice->evaluateObject("INIT", NULL, (OSObject**)&arg, 1);
     arg->release();
+
+    checkATK();
+
+    startupTimings.atkInitUS = static_cast<uint32_t>((uptimeNS() - begin) / 1000);
+    startupTimings.atkReadyUS = startupElapsedUS();
+    DBGLOG("atk", "ATK ready in %u us (%u us after start)", startupTimings.atkInitUS, startupTimings.atkReadyUS);
+    statPublisher.schedule();
+
+    // The backlight restore writes through ATK, so NVRAM is only watched once INIT ran
+    registerNVRAMNotification();
+}
+
+uint32_t AsusSMC::startupElapsedUS() const {
+    return static_cast<uint32_t>((uptimeNS() - startupTimings.beginNS) / 1000);
+}
+
+void AsusSMC::setKBLLevel(uint16_t val, bool badge, bool save) {
+    if (badge) kev.sendMessage(kevKeyboardBacklight, val, KBLMaxLevel);
+    if (save) {
+        requestKBBacklightSave(val);
+        kblCacheValid = true;
+    }
+    fadeKeyboardBacklight(kblLevelToSKBV(val));
+}
+
+void AsusSMC::loadKeyboardBacklightFade() {
+    OSDictionary *fade = OSDynamicCast(OSDictionary, getProperty("KeyboardBacklightFade"));
+    if (!fade)
+        return;
+
+    if (OSString *curve = OSDynamicCast(OSString, fade->getObject("Curve"))) {
+        if (!fadeCurveFromName(curve->getCStringNoCopy(), kblFader.curve))
+            SYSLOG("atk", "Unknown fade curve %s", curve->getCStringNoCopy());
+    }
+    if (OSNumber *duration = OSDynamicCast(OSNumber, fade->getObject("DurationMS")))
+        kblFader.durationMS = duration->unsigned32BitValue();
+    if (OSNumber *frame = OSDynamicCast(OSNumber, fade->getObject("FrameIntervalMS")))
+        kblFader.frameIntervalMS = frame->unsigned32BitValue();
+    if (OSNumber *rate = OSDynamicCast(OSNumber, fade->getObject("MaxWritesPerSecond")))
+        kblFader.maxWritesPerSecond = rate->unsigned32BitValue();
+
+    DBGLOG("atk", "Keyboard backlight fade %s %u ms, frame %u ms, max %u writes/s", FadeCurveNames[static_cast<uint8_t>(kblFader.curve)],
+           kblFader.durationMS, kblFader.frameIntervalMS, kblFader.maxWritesPerSecond);
+}
+
+void AsusSMC::fadeKeyboardBacklight(uint8_t value, bool immediate) {
+    if (immediate || !fadeTimer) {
+        command_gate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &AsusSMC::fadeKeyboardBacklightGated), &value, &immediate);
+        return;
+    }
+
+    // Latest target wins, the timer picks it up on the workloop
+    atomic_store_explicit(&pendingKBLTarget, value, memory_order_release);
+    fadeTimer->setTimeoutMS(0);
+}
+
+void AsusSMC::fadeKeyboardBacklightGated(uint8_t *value, bool *immediate) {
+    // A target still waiting for the timer is older than this one
+    atomic_store_explicit(&pendingKBLTarget, -1, memory_order_relaxed);
+    if (fadeTimer)
+        fadeTimer->cancelTimeout();
+    kblFader.jumpTo(*value, uptimeMS());
+    writeKeyboardBacklight(*value);
+}
+
+void AsusSMC::stepKeyboardBacklightFade() {
+    uint64_t now = uptimeMS();
+
+    // A new target mid-fade continues from the current value
+    int32_t target = atomic_exchange_explicit(&pendingKBLTarget, -1, memory_order_acquire);
+    if (target >= 0)
+        kblFader.setTarget(static_cast<uint8_t>(target), now);
+
+    auto step = kblFader.step(now);
+    if (step.write)
+        writeKeyboardBacklight(step.value);
+    else if (target >= 0 && !step.nextMS)
+        // Already at the target, a wake restore has nothing to write
+        atomic_store_explicit(&wakeRestoreBeginNS, 0, memory_order_relaxed);
+    // Never cancel here, a target handed over meanwhile has armed the timer again
+    if (step.nextMS)
+        fadeTimer->setTimeoutMS(step.nextMS);
+}
+
+void AsusSMC::writeKeyboardBacklight(uint8_t value) {
+    if (!skbvArg)
+        return;
+
+    skbvArg->setValue(value);
+    atkDevice->evaluateObject("SKBV", NULL, (OSObject**)&skbvArg, 1);
+
+    uint64_t wakeBegin = atomic_exchange_explicit(&wakeRestoreBeginNS, 0, memory_order_relaxed);
+    if (wakeBegin) {
+        wakeRestoreLastUS = static_cast<uint32_t>((uptimeNS() - wakeBegin) / 1000);
+        if (wakeRestoreLastUS > wakeRestoreMaxUS)
+            wakeRestoreMaxUS = wakeRestoreLastUS;
+        DBGLOG("atk", "Keyboard backlight restored in %u us", wakeRestoreLastUS);
+        statPublisher.schedule();
+    }
+}
+
+void AsusSMC::setHIDKeyboardBacklight(uint8_t value) {
+    hidDrivers.forEach([value](AsusHIDDriver *hid) {
+        hid->setKeyboardBacklight(value);
+    });
 }
 
 void AsusSMC::letSleep() {
@@ -399,20 +874,29 @@ void AsusSMC::toggleTouchpad() {
         DBGLOG("atk", "Disabled Touchpad");
     }
 
-    dispatchMessage(kKeyboardSetTouchStatus, &touchpadEnabled);
+    atomic_store_explicit(&touchStatusSnapshot, touchpadEnabled, memory_order_release);
+    queueNotification(NotifyTouchStatus);
 }
 
 void AsusSMC::displayOff() {
-    if (isPanelBackLightOn) {
-        // Read Panel brigthness value to restore later with backlight toggle
-        readPanelBrightnessValue();
+    IOService *display = copyBacklightDisplay();
 
-        dispatchTCReport(kHIDUsage_AV_TopCase_BrightnessDown, 16);
+    bool set;
+    if (panelBacklight.isOn()) {
+        set = panelBacklight.turnOff(display, panelBrightnessDirect);
+        if (!set)
+            dispatchTCReport(kHIDUsage_AV_TopCase_BrightnessDown, PanelBrightnessSteps);
     } else {
-        dispatchTCReport(kHIDUsage_AV_TopCase_BrightnessUp, panelBrightnessLevel);
+        set = panelBacklight.turnOn(display, panelBrightnessDirect);
+        if (!set)
+            dispatchTCReport(kHIDUsage_AV_TopCase_BrightnessUp, panelBacklight.restoreSteps());
     }
 
-    isPanelBackLightOn = !isPanelBackLightOn;
+    if (set) {
+        atomic_fetch_add_explicit(&panelBrightnessSets, 1, memory_order_relaxed);
+        statPublisher.schedule();
+    }
+    OSSafeReleaseNULL(display);
 }
 
 void AsusSMC::checkATK() {
@@ -436,6 +920,10 @@ void AsusSMC::checkATK() {
     if (atkDevice->validateObject("ALSC") == kIOReturnSuccess && atkDevice->validateObject("ALSS") == kIOReturnSuccess) {
         SYSLOG("atk", "Found ALS sensor");
         hasALSensor = isALSenabled = true;
+        if (OSNumber *hysteresis = OSDynamicCast(OSNumber, getProperty("ALSHysteresis")))
+            alsSampler.hysteresis = hysteresis->unsigned32BitValue();
+        if (OSNumber *threshold = OSDynamicCast(OSNumber, getProperty("ALSChangeThreshold")))
+            alsSampler.changeThreshold = threshold->unsigned32BitValue();
         toggleALS(isALSenabled);
         SYSLOG("atk", "ALS has been turned on at boot");
     } else {
@@ -456,84 +944,128 @@ void AsusSMC::toggleALS(bool state) {
     arg->release();
 }
 
-int AsusSMC::checkBacklightEntry() {
-    if (IORegistryEntry *bkl = IORegistryEntry::fromPath(backlightEntry)) {
-        OSSafeReleaseNULL(bkl);
-        return 1;
-    } else {
-        DBGLOG("atk", "Failed to find backlight entry for %s", backlightEntry);
-        return 0;
+void AsusSMC::registerBacklightDisplayNotifications() {
+    if (!backlightDisplayLock) {
+        SYSLOG("atk", "No backlight display lock, panel brightness will not be read");
+        return;
     }
-}
 
-int AsusSMC::findBacklightEntry() {
-    // Check for previous found backlight entry
-    if (checkBacklightEntry())
-        return 1;
+    auto *displayMatch = serviceMatching("AppleBacklightDisplay");
+    if (!displayMatch)
+        return;
 
-    snprintf(backlightEntry, sizeof(backlightEntry), "IOService:/AppleACPIPlatformExpert/PCI0@0/AppleACPIPCI/IGPU@2/AppleIntelFramebuffer@0/display0/AppleBacklightDisplay");
-    if (checkBacklightEntry())
-        return 1;
+    IOServiceMatchingNotificationHandler handler = OSMemberFunctionCast(IOServiceMatchingNotificationHandler, this, &AsusSMC::backlightDisplayHandler);
 
-    snprintf(backlightEntry, sizeof(backlightEntry), "IOService:/AppleACPIPlatformExpert/PCI0@0/AppleACPIPCI/GFX0@2/AppleIntelFramebuffer@0/display0/AppleBacklightDisplay");
-    if (checkBacklightEntry())
-        return 1;
+    // Publish handler runs for existing displays before addMatchingNotification returns,
+    // the terminate notifier has to be known by then
+    _displayTerminateNotify = addMatchingNotification(gIOTerminatedNotification,
+                                                      displayMatch,
+                                                      handler,
+                                                      this);
 
-    char deviceName[5][5] = {"PEG0", "PEGP", "PEGR", "P0P2", "IXVE"};
-    for (int i = 0; i < 5; i++) {
-        snprintf(backlightEntry, sizeof(backlightEntry), "IOService:/AppleACPIPlatformExpert/PCI0@0/AppleACPIPCI/%s@1/IOPP/GFX0@0/NVDA,Display-A@0/NVDA/display0/AppleBacklightDisplay", deviceName[i]);
-        if (checkBacklightEntry())
-            return 1;
+    _displayPublishNotify = addMatchingNotification(gIOFirstPublishNotification,
+                                                    displayMatch,
+                                                    handler,
+                                                    this);
 
-        snprintf(backlightEntry, sizeof(backlightEntry), "IOService:/AppleACPIPlatformExpert/PCI0@0/AppleACPIPCI/%s@3/IOPP/GFX0@0/NVDA,Display-A@0/NVDATesla/display0/AppleBacklightDisplay", deviceName[i]);
-        if (checkBacklightEntry())
-            return 1;
+    displayMatch->release();
+}
 
-        snprintf(backlightEntry, sizeof(backlightEntry), "IOService:/AppleACPIPlatformExpert/PCI0@0/AppleACPIPCI/%s@10/IOPP/GFX0@0/NVDA,Display-A@0/NVDATesla/display0/AppleBacklightDisplay", deviceName[i]);
-        if (checkBacklightEntry())
-            return 1;
+bool AsusSMC::backlightDisplayHandler(void *refCon, IOService *newService, IONotifier *notifier) {
+    IOLockLock(backlightDisplayLock);
+    if (notifier == _displayTerminateNotify) {
+        if (newService == backlightDisplay) {
+            DBGLOG("atk", "Backlight display %s terminated", newService->getName());
+            OSSafeReleaseNULL(backlightDisplay);
+        }
+    } else if (newService != backlightDisplay) {
+        DBGLOG("atk", "Backlight display %s published", newService->getName());
+        OSSafeReleaseNULL(backlightDisplay);
+        newService->retain();
+        backlightDisplay = newService;
+    }
+    IOLockUnlock(backlightDisplayLock);
+    return true;
+}
+
+IOService *AsusSMC::copyBacklightDisplay() {
+    if (!backlightDisplayLock)
+        return nullptr;
+
+    IOLockLock(backlightDisplayLock);
+    IOService *display = backlightDisplay;
+    if (display)
+        display->retain();
+    IOLockUnlock(backlightDisplayLock);
+    return display;
+}
+
+bool AsusSMC::setPanelBrightness(IOService *display, uint32_t value, uint32_t min, uint32_t max) {
+    if (!writePanelBrightness(display, value, min, max))
+        return false;
 
-        snprintf(backlightEntry, sizeof(backlightEntry), "IOService:/AppleACPIPlatformExpert/PCI0@0/AppleACPIPCI/%s@1/IOPP/display@0/NVDA,Display-A@0/NVDA/display0/AppleBacklightDisplay", deviceName[i]);
-        if (checkBacklightEntry())
-            return 1;
+    atomic_fetch_add_explicit(&panelBrightnessSets, 1, memory_order_relaxed);
+    statPublisher.schedule();
+    return true;
+}
 
-        snprintf(backlightEntry, sizeof(backlightEntry), "IOService:/AppleACPIPlatformExpert/PCI0@0/AppleACPIPCI/%s@3/IOPP/display@0/NVDA,Display-A@0/NVDATesla/display0/AppleBacklightDisplay", deviceName[i]);
-        if (checkBacklightEntry())
-            return 1;
+void AsusSMC::loadPanelBrightnessSettings() {
+    OSDictionary *panel = OSDynamicCast(OSDictionary, getProperty("PanelBrightness"));
+    if (!panel)
+        return;
 
-        snprintf(backlightEntry, sizeof(backlightEntry), "IOService:/AppleACPIPlatformExpert/PCI0@0/AppleACPIPCI/%s@10/IOPP/display@0/NVDA,Display-A@0/NVDATesla/display0/AppleBacklightDisplay", deviceName[i]);
-        if (checkBacklightEntry())
-            return 1;
+    if (OSNumber *levels = OSDynamicCast(OSNumber, panel->getObject("ATKLevels"))) {
+        uint32_t count = levels->unsigned32BitValue();
+        if (count >= 2 && count <= PanelATKMaxLevel + 1)
+            panelATKMaxLevel = count - 1;
+        else
+            SYSLOG("atk", "Ignoring PanelBrightness ATKLevels %u, expected 2...%u", count, PanelATKMaxLevel + 1);
     }
+    if (OSBoolean *direct = OSDynamicCast(OSBoolean, panel->getObject("Direct")))
+        panelBrightnessDirect = direct->isTrue();
 
-    return 0;
+    DBGLOG("atk", "Panel brightness %u ATK levels, %s", panelATKMaxLevel + 1, panelBrightnessDirect ? "direct" : "keystrokes");
 }
 
-void AsusSMC::readPanelBrightnessValue() {
-    if (!findBacklightEntry()) {
-        DBGLOG("atk", "GPU device not found");
+void AsusSMC::requestPanelLevel(uint8_t level, uint16_t fallbackUsage) {
+    atomic_fetch_add_explicit(&panelLevelRequests, 1, memory_order_relaxed);
+    statPublisher.schedule();
+
+    // Keystrokes are relative, they cannot be merged
+    IOService *display = panelBrightnessDirect ? copyBacklightDisplay() : nullptr;
+    if (!display) {
+        atomic_fetch_add_explicit(&panelKeystrokeFallbacks, 1, memory_order_relaxed);
+        dispatchTCReport(fallbackUsage);
         return;
     }
+    display->release();
 
-    IORegistryEntry *displayDeviceEntry = IORegistryEntry::fromPath(backlightEntry);
+    // Only the first notification of a burst arms the timer, later ones just update the level
+    if (atomic_exchange_explicit(&pendingPanelLevel, level, memory_order_acq_rel) >= 0)
+        return;
 
-    if (displayDeviceEntry) {
-        if (OSDictionary *ioDisplayParaDict = OSDynamicCast(OSDictionary, displayDeviceEntry->getProperty("IODisplayParameters"))) {
-            if (OSDictionary *brightnessDict = OSDynamicCast(OSDictionary, ioDisplayParaDict->getObject("brightness"))) {
-                if (OSNumber *brightnessValue = OSDynamicCast(OSNumber, brightnessDict->getObject("value"))) {
-                    panelBrightnessLevel = brightnessValue->unsigned32BitValue() / 64;
-                    DBGLOG("atk", "Panel brightness level: %d", panelBrightnessLevel);
-                } else {
-                    DBGLOG("atk", "Failed to read brightness value");
-                }
-            } else {
-                DBGLOG("atk", "Failed to find dictionary brightness");
-            }
-        } else {
-            DBGLOG("atk", "Failed to find dictionary IODisplayParameters");
-        }
+    if (brightnessTimer)
+        brightnessTimer->setTimeoutMS(PanelBrightnessCoalesceMS);
+    else
+        applyPanelLevel();
+}
+
+void AsusSMC::applyPanelLevel() {
+    int32_t level = atomic_exchange_explicit(&pendingPanelLevel, -1, memory_order_acq_rel);
+    if (level < 0)
+        return;
+
+    IOService *display = copyBacklightDisplay();
+    if (!display)
+        return;
+
+    uint32_t value, min, max;
+    if (readPanelBrightness(display, value, min, max) &&
+        setPanelBrightness(display, atkLevelToPanelBrightness(static_cast<uint8_t>(level), panelATKMaxLevel, min, max), min, max)) {
+        // Panel was turned back on with the brightness keys
+        panelBacklight.brightnessChanged();
     }
-    OSSafeReleaseNULL(displayDeviceEntry);
+    display->release();
 }
 
 #pragma mark -
@@ -551,41 +1083,46 @@ void AsusSMC::initVirtualKeyboard() {
     }
 }
 
-IOReturn AsusSMC::postKeyboardInputReport(const void *report, uint32_t reportSize) {
-    IOReturn result = kIOReturnError;
+void AsusSMC::deinitVirtualKeyboard() {
+    if (!_virtualKBrd)
+        return;
 
-    if (!report || reportSize == 0) {
-        return kIOReturnBadArgument;
-    }
+    _virtualKBrd->stop(this);
+    _virtualKBrd->detach(this);
+    OSSafeReleaseNULL(_virtualKBrd);
+}
 
-    if (_virtualKBrd) {
-        if (auto buffer = IOBufferMemoryDescriptor::withBytes(report, reportSize, kIODirectionNone)) {
-            result = _virtualKBrd->handleReport(buffer, kIOHIDReportTypeInput, kIOHIDOptionsTypeNone);
-            buffer->release();
-        }
-    }
+IOReturn AsusSMC::postKeyboardInputRepeat(const void *pressReport, const void *releaseReport, uint32_t reportSize, uint32_t count) {
+    if (!_virtualKBrd)
+        return kIOReturnError;
 
-    return result;
+    return _virtualKBrd->postKeyRepeat(pressReport, releaseReport, reportSize, count);
 }
 
 void AsusSMC::dispatchCSMRReport(int code, int loop) {
     DBGLOG("atk", "Dispatched key %d(0x%x), loop %d time(s)", code, code, loop);
-    while (loop--) {
-        csmrreport.keys.insert(code);
-        postKeyboardInputReport(&csmrreport, sizeof(csmrreport));
-        csmrreport.keys.erase(code);
-        postKeyboardInputReport(&csmrreport, sizeof(csmrreport));
-    }
+    if (loop <= 0)
+        return;
+
+    csmrkeys.insert(code);
+    csmrkeys.serialize(csmrreport.keys);
+    consumer_input press = csmrreport;
+    csmrkeys.erase(code);
+    csmrkeys.serialize(csmrreport.keys);
+    postKeyboardInputRepeat(&press, &csmrreport, sizeof(csmrreport), loop);
 }
 
 void AsusSMC::dispatchTCReport(int code, int loop) {
     DBGLOG("atk", "Dispatched key %d(0x%x), loop %d time(s)", code, code, loop);
-    while (loop--) {
-        tcreport.keys.insert(code);
-        postKeyboardInputReport(&tcreport, sizeof(tcreport));
-        tcreport.keys.erase(code);
-        postKeyboardInputReport(&tcreport, sizeof(tcreport));
-    }
+    if (loop <= 0)
+        return;
+
+    tckeys.insert(code);
+    tckeys.serialize(tcreport.keys);
+    apple_vendor_top_case_input press = tcreport;
+    tckeys.erase(code);
+    tckeys.serialize(tcreport.keys);
+    postKeyboardInputRepeat(&press, &tcreport, sizeof(tcreport), loop);
 }
 
 #pragma mark -
@@ -617,12 +1154,24 @@ void AsusSMC::registerNotifications() {
 void AsusSMC::notificationHandlerGated(IOService *newService, IONotifier *notifier) {
     if (notifier == _publishNotify) {
         SYSLOG("notify", "Notification consumer published: %s", newService->getName());
-        _notificationServices->setObject(newService);
+        if (notificationConsumerCount < MaxNotificationConsumers) {
+            newService->retain();
+            notificationConsumers[notificationConsumerCount++] = {newService, 0, 0, 0};
+        } else {
+            SYSLOG("notify", "Too many notification consumers, ignoring %s", newService->getName());
+        }
     }
 
     if (notifier == _terminateNotify) {
         SYSLOG("notify", "Notification consumer terminated: %s", newService->getName());
-        _notificationServices->removeObject(newService);
+        for (uint32_t i = 0; i < notificationConsumerCount; i++) {
+            if (notificationConsumers[i].service == newService) {
+                newService->release();
+                notificationConsumers[i] = notificationConsumers[--notificationConsumerCount];
+                notificationConsumers[notificationConsumerCount] = {};
+                break;
+            }
+        }
     }
 }
 
@@ -631,18 +1180,92 @@ bool AsusSMC::notificationHandler(void *refCon, IOService *newService, IONotifie
     return true;
 }
 
-void AsusSMC::dispatchMessageGated(int *message, void *data) {
-    OSCollectionIterator *i = OSCollectionIterator::withCollection(_notificationServices);
+void AsusSMC::notifyKeyPress(uint64_t timestamp) {
+    atomic_fetch_add_explicit(&keyPressesSeen, 1, memory_order_relaxed);
+    statPublisher.schedule();
+
+    // Coalesce key storms, consumers only need a recent timestamp
+    if (!keyPressLimiter.admit(timestamp))
+        return;
+
+    atomic_store_explicit(&keyPressTimeSnapshot, timestamp, memory_order_release);
+    atomic_fetch_add_explicit(&keyPressesNotified, 1, memory_order_relaxed);
+    queueNotification(NotifyKeyPressTime);
+}
+
+void AsusSMC::queueNotification(uint32_t kinds) {
+    atomic_fetch_or_explicit(&pendingNotifications, kinds, memory_order_release);
+    if (notificationSource)
+        notificationSource->interruptOccurred(nullptr, nullptr, 0);
+    else if (command_gate)
+        // No event source to defer to, deliver now while keeping consumers serialized
+        command_gate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &AsusSMC::deliverNotifications));
+    else
+        deliverNotifications();
+}
+
+void AsusSMC::deliverNotifications() {
+    uint32_t kinds = atomic_exchange_explicit(&pendingNotifications, 0, memory_order_acquire);
+    if (kinds)
+        statPublisher.schedule();
 
-    if (i != NULL) {
-        while (IOService *service = OSDynamicCast(IOService, i->getNextObject()))
-            service->message(*message, this, data);
-        i->release();
+    if (kinds & NotifyTouchStatus) {
+        bool status = atomic_load_explicit(&touchStatusSnapshot, memory_order_acquire);
+        deliverNotification(kKeyboardSetTouchStatus, &status, sizeof(status));
+    }
+
+    if (kinds & NotifyKeyPressTime) {
+        uint64_t timestamp = atomic_load_explicit(&keyPressTimeSnapshot, memory_order_acquire);
+        deliverNotification(kKeyboardKeyPressTime, &timestamp, sizeof(timestamp));
     }
 }
 
-void AsusSMC::dispatchMessage(int message, void *data) {
-    command_gate->runAction(OSMemberFunctionCast(IOCommandGate::Action, this, &AsusSMC::dispatchMessageGated), &message, data);
+void AsusSMC::deliverNotification(UInt32 type, const void *data, uint32_t size) {
+    for (uint32_t i = 0; i < notificationConsumerCount; i++) {
+        NotificationConsumer &consumer = notificationConsumers[i];
+
+        // Consumers may write through the pointer, give each one a fresh copy
+        uint64_t copy = 0;
+        lilu_os_memcpy(&copy, data, size);
+
+        uint64_t start, end, elapsed;
+        clock_get_uptime(&start);
+        consumer.service->message(type, this, &copy);
+        clock_get_uptime(&end);
+        absolutetime_to_nanoseconds(end - start, &elapsed);
+
+        consumer.deliveries++;
+        consumer.lastLatencyUS = static_cast<uint32_t>(elapsed / 1000);
+        if (consumer.lastLatencyUS > consumer.maxLatencyUS)
+            consumer.maxLatencyUS = consumer.lastLatencyUS;
+    }
+}
+
+void AsusSMC::publishNotificationStatistics() {
+    OSArray *stats = OSArray::withCapacity(notificationConsumerCount);
+    if (!stats)
+        return;
+
+    for (uint32_t i = 0; i < notificationConsumerCount; i++) {
+        const NotificationConsumer &consumer = notificationConsumers[i];
+        const StatCounter counters[] = {
+            {"Deliveries", consumer.deliveries},
+            {"LastLatencyUS", consumer.lastLatencyUS},
+            {"MaxLatencyUS", consumer.maxLatencyUS},
+        };
+        OSDictionary *entry = makeCounters(counters);
+        if (!entry)
+            continue;
+        if (OSString *name = OSString::withCString(consumer.service->getName())) {
+            entry->setObject("Name", name);
+            name->release();
+        }
+        stats->setObject(entry);
+        entry->release();
+    }
+
+    setProperty("NotificationStatistics", stats);
+    stats->release();
 }
 
 #pragma mark -
@@ -679,7 +1302,7 @@ void AsusSMC::registerVSMC() {
         SMC_KEY_ATTRIBUTE_READ | SMC_KEY_ATTRIBUTE_WRITE | SMC_KEY_ATTRIBUTE_FUNCTION));
 
     VirtualSMCAPI::addKey(KeyLKSB, vsmcPlugin.data, VirtualSMCAPI::valueWithData(
-        reinterpret_cast<const SMC_DATA *>(&lkb), sizeof(lkb), SmcKeyTypeLkb, new SMCKBrdBLightValue(atkDevice, _hidDrivers),
+        reinterpret_cast<const SMC_DATA *>(&lkb), sizeof(lkb), SmcKeyTypeLkb, new SMCKBrdBLightValue(this),
         SMC_KEY_ATTRIBUTE_READ | SMC_KEY_ATTRIBUTE_WRITE | SMC_KEY_ATTRIBUTE_FUNCTION));
 
     VirtualSMCAPI::addKey(KeyLKSS, vsmcPlugin.data, VirtualSMCAPI::valueWithData(
@@ -697,15 +1320,16 @@ bool AsusSMC::vsmcNotificationHandler(void *sensors, void *refCon, IOService *vs
         auto ret = vsmc->callPlatformFunction(VirtualSMCAPI::SubmitPlugin, true, sensors, &self->vsmcPlugin, nullptr, nullptr);
         if (ret == kIOReturnSuccess) {
             DBGLOG("alsd", "Submitted plugin");
+            self->startupTimings.vsmcReadyUS = self->startupElapsedUS();
+            self->statPublisher.schedule();
 
-            self->workloop = self->getWorkLoop();
             self->poller = IOTimerEventSource::timerEventSource(self, [](OSObject *object, IOTimerEventSource *sender) {
                 auto ls = OSDynamicCast(AsusSMC, object);
                 if (ls) ls->refreshSensor(true);
             });
 
-            if (!self->poller || !self->workloop) {
-                SYSLOG("alsd", "Failed to create poller or workloop");
+            if (!self->poller) {
+                SYSLOG("alsd", "Failed to create poller");
                 return false;
             }
 
@@ -736,20 +1360,35 @@ bool AsusSMC::refreshSensor(bool post) {
     uint32_t lux = 0;
     auto ret = atkDevice->evaluateInteger("ALSS", &lux);
     if (ret != kIOReturnSuccess)
-        lux = 0xFFFFFFFF; // ACPI invalid
+        lux = ALSInvalidLux;
+
+    bool changed = alsSampler.addSample(lux, uptimeMS());
+    statPublisher.schedule();
 
-    atomic_store_explicit(&currentLux, lux, memory_order_release);
+    atomic_store_explicit(&currentLux, alsSampler.lux(), memory_order_release);
 
     if (post) {
-        VirtualSMCAPI::postInterrupt(SmcEventALSChange);
-        poller->setTimeoutMS(SensorUpdateTimeoutMS);
+        if (changed)
+            VirtualSMCAPI::postInterrupt(SmcEventALSChange);
+
+        // ATK notifies us about changes, keep polling only to catch missed ones
+        bool notified = atomic_load_explicit(&alsNotifySeen, memory_order_acquire);
+        poller->setTimeoutMS(alsSampler.nextIntervalMS(notified ? SensorFallbackTimeoutMS : ALSSampler::StableIntervalMS));
     }
 
-    DBGLOG("alsd", "refreshSensor lux %u", lux);
+    DBGLOG("alsd", "refreshSensor lux %u filtered %u", lux, alsSampler.lux());
 
     return ret == kIOReturnSuccess;
 }
 
+void AsusSMC::handleALSNotification() {
+    atomic_store_explicit(&alsNotifySeen, true, memory_order_release);
+
+    // Timer fires on the workloop, so ALSS is not evaluated from notification context
+    if (poller)
+        poller->setTimeoutMS(0);
+}
+
 EXPORT extern "C" kern_return_t ADDPR(kern_start)(kmod_info_t *, void *) {
     // Report success but actually do not start and let I/O Kit unload us.
     // This works better and increases boot speed in some cases.
@@ -10,12 +10,20 @@
 
 #include <IOKit/IOTimerEventSource.h>
 #include <IOKit/IOCommandGate.h>
+#include <IOKit/IOInterruptEventSource.h>
 #include <IOKit/IONVRAM.h>
 #include "HIDReport.hpp"
 #include "HIDUsageTables.h"
+#include "ATKEvents.hpp"
 #include "VirtualHIDKeyboard.hpp"
 #include "KernEventServer.hpp"
 #include "KeyImplementations.hpp"
+#include "ALSSampler.hpp"
+#include "BacklightFade.hpp"
+#include "HIDDriverRegistry.hpp"
+#include "ATKEventQueue.hpp"
+#include "PanelBacklight.hpp"
+#include "StatPublisher.hpp"
 
 struct guid_block {
     char guid[16];
@@ -39,16 +47,8 @@ struct guid_block {
 #define ACPI_WMI_STRING      0x4    /* GUID takes & returns a string */
 #define ACPI_WMI_EVENT       0x8    /* GUID is an event */
 
-#define AsusSMCEventCode 0x8102
-
 #define kAsusKeyboardBacklight "asus-keyboard-backlight"
 
-const UInt8 NOTIFY_BRIGHTNESS_UP_MIN = 0x10;
-const UInt8 NOTIFY_BRIGHTNESS_UP_MAX = 0x1F;
-
-const UInt8 NOTIFY_BRIGHTNESS_DOWN_MIN = 0x20;
-const UInt8 NOTIFY_BRIGHTNESS_DOWN_MAX = 0x2F;
-
 #define kDeliverNotifications "RM,deliverNotifications"
 enum {
     kKeyboardSetTouchStatus = iokit_vendor_specific_msg(100), // set disable/enable touchpad (data is bool*)
@@ -56,13 +56,6 @@ enum {
     kKeyboardKeyPressTime = iokit_vendor_specific_msg(110),   // notify of timestamp a non-modifier key was pressed (data is uint64_t*)
 };
 
-enum {
-    kevKeyboardBacklight = 1,
-    kevAirplaneMode = 2,
-    kevSleep = 3,
-    kevTouchpad = 4,
-};
-
 class AsusSMC : public IOService {
     OSDeclareDefaultStructors(AsusSMC)
 
@@ -79,14 +72,31 @@ public:
     bool init(OSDictionary *dictionary = 0) override;
     bool start(IOService *provider) override;
     void stop(IOService *provider) override;
+    void free() override;
     IOService *probe(IOService *provider, SInt32 *score) override;
     IOReturn message(UInt32 type, IOService *provider, void *argument) override;
+    void systemWillShutdown(IOOptionBits specifier) override;
+    IOWorkLoop *getWorkLoop() const override;
 
     void letSleep();
     void toggleAirplaneMode();
     void toggleTouchpad();
     void displayOff();
 
+    /**
+     *  Fade keyboard backlight to SKBV value. A fade only hands the target to
+     *  the fade timer and never waits for the workloop, so LKSB writes do not block.
+     *
+     *  @param value      8-bit SKBV argument
+     *  @param immediate  skip the fade and write value right away on the command gate
+     */
+    void fadeKeyboardBacklight(uint8_t value, bool immediate = false);
+
+    /**
+     *  Forward SKBV value to USB HID keyboards
+     */
+    void setHIDKeyboardBacklight(uint8_t value);
+
 protected:
     OSDictionary *properties {nullptr};
 
@@ -112,6 +122,8 @@ protected:
 
     /**
      *  A workloop in charge of handling timer events with requests.
+     *  Private to AsusSMC, so ATK handling and consumer delivery never
+     *  wait behind other drivers on the ACPI platform workloop.
      */
     IOWorkLoop *workloop {nullptr};
 
@@ -120,16 +132,56 @@ protected:
      */
     IOCommandGate *command_gate {nullptr};
 
+    /**
+     *  Publishes the *Statistics properties from the workloop when counters change
+     */
+    StatPublisher statPublisher;
+    void publishStatistics();
+
+    /**
+     *  Staged start, ATK bring-up runs on the workloop once the service is published
+     */
+    IOTimerEventSource *startupTimer {nullptr};
+    void startATK();
+
+    /**
+     *  Startup stage timings in us since start, 0 until the stage completes
+     */
+    struct StartupTimings {
+        uint64_t beginNS;
+        uint32_t publishUS;
+        uint32_t atkInitUS;
+        uint32_t atkReadyUS;
+        uint32_t nvramReadyUS;
+        uint32_t vsmcReadyUS;
+    } startupTimings {};
+    uint32_t startupElapsedUS() const;
+
     /**
      *  Workloop timer event source for status updates
      */
     IOTimerEventSource *poller {nullptr};
 
     /**
-     *  Interrupt submission timeout
+     *  Delay before the first sensor refresh
      */
     static constexpr uint32_t SensorUpdateTimeoutMS {1000};
 
+    /**
+     *  Fallback poll interval once ATK has delivered ALS notifications
+     */
+    static constexpr uint32_t SensorFallbackTimeoutMS {10000};
+
+    /**
+     *  ATK delivers ALS notifications (0xC6/0xC7) on this machine
+     */
+    _Atomic(bool) alsNotifySeen = ATOMIC_VAR_INIT(false);
+
+    /**
+     *  Smoothing and adaptive sampling of ALSS readings, only touched on the workloop
+     */
+    ALSSampler alsSampler;
+
     /**
      *  Send commands to user-space daemon
      */
@@ -142,6 +194,8 @@ protected:
 
     consumer_input csmrreport;
     apple_vendor_top_case_input tcreport;
+    key_bitmap csmrkeys;
+    key_bitmap tckeys;
 
     /**
      *  Touchpad enabled status
@@ -155,6 +209,21 @@ protected:
 
     uint16_t kbl_level = 0;
 
+    /**
+     *  kbl_level matches the value persisted in NVRAM
+     */
+    bool kblCacheValid {false};
+
+    /**
+     *  Wake path statistics for setPowerState, restore time runs from
+     *  the wake until the first SKBV write of the restored level
+     */
+    _Atomic(uint64_t) wakeRestoreBeginNS = ATOMIC_VAR_INIT(0);
+    uint32_t wakeRestoreLastUS {0};
+    uint32_t wakeRestoreMaxUS {0};
+    uint32_t kblCacheHits {0};
+    uint32_t kblCacheMisses {0};
+
     /**
      *  Workaround for Catalina
      */
@@ -162,6 +231,68 @@ protected:
     void saveKBBacklightToNVRAM(uint16_t val);
     uint16_t readKBBacklightFromNVRAM();
 
+    /**
+     *  NVRAM is attached through a matching notification registered after ATK INIT, start never waits for it
+     */
+    IORegistryEntry *nvramEntry {nullptr};
+    IONotifier *_nvramNotify {nullptr};
+    void registerNVRAMNotification();
+    bool nvramHandler(void *refCon, IOService *newService, IONotifier *notifier);
+    void nvramPublishedGated(IOService *nvram);
+
+    /**
+     *  Saved keyboard backlight level, NVRAM is only read when the cache is cold
+     */
+    uint16_t loadKBBacklightLevel();
+
+    /**
+     *  Keyboard backlight fade, only touched on the workloop
+     */
+    BacklightFader kblFader;
+    IOTimerEventSource *fadeTimer {nullptr};
+
+    /**
+     *  Latest fade target handed to fadeTimer, -1 if none
+     */
+    _Atomic(int32_t) pendingKBLTarget = ATOMIC_VAR_INIT(-1);
+    void loadKeyboardBacklightFade();
+    void fadeKeyboardBacklightGated(uint8_t *value, bool *immediate);
+    void stepKeyboardBacklightFade();
+    void writeKeyboardBacklight(uint8_t value);
+
+    /**
+     *  SKBV argument reused for every write
+     */
+    OSNumber *skbvArg {nullptr};
+
+    /**
+     *  NVRAM writes are deferred until the level has not changed for this long
+     */
+    static constexpr uint32_t NVRAMSaveQuietMS {2000};
+
+    /**
+     *  Workloop timer flushing the pending level to NVRAM
+     */
+    IOTimerEventSource *nvramTimer {nullptr};
+
+    /**
+     *  Level waiting to be written, -1 if none
+     */
+    _Atomic(int32_t) pendingKBLSave = ATOMIC_VAR_INIT(-1);
+
+    _Atomic(uint32_t) nvramWritesRequested = ATOMIC_VAR_INIT(0);
+    _Atomic(uint32_t) nvramWritesPerformed = ATOMIC_VAR_INIT(0);
+
+    /**
+     *  Queue keyboard backlight level for a deferred NVRAM write
+     */
+    void requestKBBacklightSave(uint16_t val);
+
+    /**
+     *  Write pending keyboard backlight level to NVRAM now
+     */
+    void flushKBBacklightSave();
+
     /**
      *  Direct ACPI messaging support
      *  Originally, receiving ACPI messages takes several unnecessary steps (thanks, ASUS!)
@@ -182,13 +313,48 @@ protected:
     /**
      *  Backlight status (Fn+F7)
      */
-    bool isPanelBackLightOn {true};
+    PanelBacklight panelBacklight;
+
+    /**
+     *  ATK notify code -> action mapping, defaults patched with ATKEventMap
+     */
+    ATKEvent atkEvents[ATKEventCount];
+    void loadATKEventOverrides();
 
     /**
      *  Handle message from ATK
      */
     void handleMessage(int code);
 
+    /**
+     *  ATK notifications are queued in the ACPI callout and handled on the workloop
+     */
+    ATKEventQueue atkEventQueue;
+    IOInterruptEventSource *atkEventSource {nullptr};
+    void deliverATKEvents();
+
+    /**
+     *  ATK notify code for the ACPI notification, evaluates _WED without DMES
+     */
+    uint32_t readATKEventCode(uint32_t event);
+
+    /**
+     *  Per-stage latency of ATK events, only touched on the workloop
+     */
+    uint32_t atkEventsHandled {0};
+    uint32_t atkQueueLastUS {0};
+    uint32_t atkQueueMaxUS {0};
+    uint32_t atkDecodeMaxUS {0};
+    uint32_t atkHandleMaxUS {0};
+
+    /**
+     *  Forward key press timestamp (ns) to notification consumers, at most once per KeyPressNotifyIntervalMS
+     */
+    KeyPressLimiter keyPressLimiter;
+    _Atomic(uint32_t) keyPressesSeen = ATOMIC_VAR_INIT(0);
+    _Atomic(uint32_t) keyPressesNotified = ATOMIC_VAR_INIT(0);
+    void notifyKeyPress(uint64_t timestamp);
+
     /**
      *  Check ALS and keyboard backlight availability
      */
@@ -200,27 +366,79 @@ protected:
     void toggleALS(bool state);
 
     /**
-     *  Brightness
+     *  Retained AppleBacklightDisplay, tracked by matching notifications
+     *  so the key path never has to search the registry
+     */
+    IOService *backlightDisplay {nullptr};
+    IOLock *backlightDisplayLock {nullptr};
+    IONotifier *_displayPublishNotify {nullptr};
+    IONotifier *_displayTerminateNotify {nullptr};
+    void registerBacklightDisplayNotifications();
+    bool backlightDisplayHandler(void *refCon, IOService *newService, IONotifier *notifier);
+
+    /**
+     *  Current backlight display, retained, nullptr if none is published
+     */
+    IOService *copyBacklightDisplay();
+
+    /**
+     *  Set brightness value clamped to min...max already read from display and count it
+     */
+    bool setPanelBrightness(IOService *display, uint32_t value, uint32_t min, uint32_t max);
+
+    /**
+     *  Highest level sent by ATK brightness notifications, from PanelBrightness ATKLevels
+     */
+    uint32_t panelATKMaxLevel {PanelATKMaxLevel};
+
+    /**
+     *  Set brightness on the backlight display, otherwise emulate brightness keys (with OSD)
      */
-    UInt32 panelBrightnessLevel {16};
-    char backlightEntry[1000];
-    int checkBacklightEntry();
-    int findBacklightEntry();
+    bool panelBrightnessDirect {true};
+    void loadPanelBrightnessSettings();
 
     /**
-     *  Reading AppleBezel Values from Apple Backlight Panel driver for controlling the bezel levels
+     *  Brightness notifications closer than this are merged into one set
      */
-    void readPanelBrightnessValue();
+    static constexpr uint32_t PanelBrightnessCoalesceMS {20};
+
+    /**
+     *  Workloop timer applying the pending panel level
+     */
+    IOTimerEventSource *brightnessTimer {nullptr};
+
+    /**
+     *  ATK panel level waiting to be set, -1 if none
+     */
+    _Atomic(int32_t) pendingPanelLevel = ATOMIC_VAR_INIT(-1);
+
+    _Atomic(uint32_t) panelLevelRequests = ATOMIC_VAR_INIT(0);
+    _Atomic(uint32_t) panelBrightnessSets = ATOMIC_VAR_INIT(0);
+    _Atomic(uint32_t) panelKeystrokeFallbacks = ATOMIC_VAR_INIT(0);
+
+    /**
+     *  Handle ATK brightness notification
+     *
+     *  @param level          new ATK panel level
+     *  @param fallbackUsage  brightness key to emulate without a backlight display
+     */
+    void requestPanelLevel(uint8_t level, uint16_t fallbackUsage);
+    void applyPanelLevel();
 
     /**
      *  Initialize virtual HID keyboard
      */
     void initVirtualKeyboard();
 
+    /**
+     *  Stop and detach virtual HID keyboard while its workloop is still alive
+     */
+    void deinitVirtualKeyboard();
+
     /**
      *  Simulate keyboard events, taken from Karabiner-Elements
      */
-    IOReturn postKeyboardInputReport(const void *report, uint32_t reportSize);
+    IOReturn postKeyboardInputRepeat(const void *pressReport, const void *releaseReport, uint32_t reportSize, uint32_t count);
 
     void dispatchCSMRReport(int code, int loop = 1);
     void dispatchTCReport(int code, int loop = 1);
@@ -230,17 +448,52 @@ protected:
      */
     IONotifier *_publishNotify {nullptr};
     IONotifier *_terminateNotify {nullptr};
-    OSSet *_notificationServices {nullptr};
     void registerNotifications(void);
     void notificationHandlerGated(IOService *newService, IONotifier *notifier);
     bool notificationHandler(void *refCon, IOService *newService, IONotifier *notifier);
-    void dispatchMessageGated(int *message, void *data);
-    void dispatchMessage(int message, void *data);
 
     /**
-     *  HID drivers
+     *  Retained notification consumer with delivery statistics, only touched on the workloop
      */
-    OSSet *_hidDrivers {nullptr};
+    struct NotificationConsumer {
+        IOService *service;
+        uint32_t deliveries;
+        uint32_t lastLatencyUS;
+        uint32_t maxLatencyUS;
+    };
+    static constexpr uint32_t MaxNotificationConsumers {4};
+    NotificationConsumer notificationConsumers[MaxNotificationConsumers] {};
+    uint32_t notificationConsumerCount {0};
+
+    /**
+     *  Notification kinds waiting for delivery
+     */
+    enum : uint32_t {
+        NotifyTouchStatus   = 1U << 0,
+        NotifyKeyPressTime  = 1U << 1,
+    };
+    _Atomic(uint32_t) pendingNotifications = ATOMIC_VAR_INIT(0);
+
+    /**
+     *  State snapshot handed to consumers, each one gets its own copy
+     */
+    _Atomic(bool) touchStatusSnapshot = ATOMIC_VAR_INIT(true);
+    _Atomic(uint64_t) keyPressTimeSnapshot = ATOMIC_VAR_INIT(0);
+
+    /**
+     *  Delivers pending notifications from the workloop so the caller never waits on consumers.
+     *  Without the event source they are delivered inline on the command gate.
+     */
+    IOInterruptEventSource *notificationSource {nullptr};
+    void queueNotification(uint32_t kinds);
+    void deliverNotifications();
+    void deliverNotification(UInt32 type, const void *data, uint32_t size);
+    void publishNotificationStatistics();
+
+    /**
+     *  HID drivers, updated only on kAddAsusHIDDriver/kDelAsusHIDDriver
+     */
+    HIDDriverRegistry hidDrivers;
 
     /**
      *  Register ourself as a VirtualSMC plugin
@@ -264,6 +517,11 @@ protected:
      */
     bool refreshSensor(bool post);
 
+    /**
+     *  Refresh sensor on the next workloop pass in response to ATK ALS notification
+     */
+    void handleALSNotification();
+
 private:
     void subscribePowerEvents(IOService *provider);
 
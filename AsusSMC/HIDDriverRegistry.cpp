@@ -0,0 +1,107 @@
+//
+//  HIDDriverRegistry.cpp
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#include "HIDDriverRegistry.hpp"
+
+bool HIDDriverRegistry::init() {
+    writeLock = IOLockAlloc();
+    return writeLock != nullptr;
+}
+
+void HIDDriverRegistry::deinit() {
+    if (!writeLock)
+        return;
+
+    removeAll();
+    IOLockFree(writeLock);
+    writeLock = nullptr;
+}
+
+bool HIDDriverRegistry::add(AsusHIDDriver *driver) {
+    if (!driver || !writeLock)
+        return false;
+
+    IOLockLock(writeLock);
+    Snapshot next = slots[atomic_load_explicit(&current, memory_order_relaxed)];
+    for (uint32_t i = 0; i < next.count; i++) {
+        if (next.drivers[i] == driver) {
+            IOLockUnlock(writeLock);
+            return false;
+        }
+    }
+
+    if (next.count == Capacity) {
+        IOLockUnlock(writeLock);
+        return false;
+    }
+
+    driver->retain();
+    next.drivers[next.count++] = driver;
+    publish(next);
+    IOLockUnlock(writeLock);
+    return true;
+}
+
+bool HIDDriverRegistry::remove(IOService *driver) {
+    if (!driver || !writeLock)
+        return false;
+
+    IOLockLock(writeLock);
+    Snapshot next = slots[atomic_load_explicit(&current, memory_order_relaxed)];
+    AsusHIDDriver *removed = nullptr;
+    for (uint32_t i = 0; i < next.count; i++) {
+        if (next.drivers[i] == driver) {
+            removed = next.drivers[i];
+            next.drivers[i] = next.drivers[--next.count];
+            next.drivers[next.count] = nullptr;
+            break;
+        }
+    }
+
+    if (!removed) {
+        IOLockUnlock(writeLock);
+        return false;
+    }
+
+    publish(next);
+    IOLockUnlock(writeLock);
+
+    // No reader can reach it any more
+    removed->release();
+    return true;
+}
+
+void HIDDriverRegistry::removeAll() {
+    if (!writeLock)
+        return;
+
+    IOLockLock(writeLock);
+    Snapshot old = slots[atomic_load_explicit(&current, memory_order_relaxed)];
+    publish(Snapshot {});
+    IOLockUnlock(writeLock);
+
+    for (uint32_t i = 0; i < old.count; i++)
+        old.drivers[i]->release();
+}
+
+void HIDDriverRegistry::waitForReaders(uint32_t index) {
+    while (atomic_load_explicit(&readers[index], memory_order_seq_cst) != 0)
+        IODelay(1);
+}
+
+void HIDDriverRegistry::publish(const Snapshot &next) {
+    uint32_t published = atomic_load_explicit(&current, memory_order_relaxed);
+    uint32_t spare = published ^ 1;
+
+    // Readers that lost the race with the previous flip may still be backing out
+    waitForReaders(spare);
+    slots[spare] = next;
+    atomic_store_explicit(&current, spare, memory_order_seq_cst);
+
+    waitForReaders(published);
+    slots[published] = next;
+}
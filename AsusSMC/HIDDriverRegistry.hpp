@@ -0,0 +1,98 @@
+//
+//  HIDDriverRegistry.hpp
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef HIDDriverRegistry_hpp
+#define HIDDriverRegistry_hpp
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOLocks.h>
+#include <VirtualSMCSDK/kern_vsmcapi.hpp>
+#include "AsusHIDDriver.hpp"
+
+/**
+ *  Fixed-capacity set of retained HID drivers with lock-free readers.
+ *
+ *  Two copies of the driver list are kept (left-right scheme). Readers pin the
+ *  published copy with a per-copy reader count and never block. Writers are
+ *  serialized, update the unpublished copy, flip, wait for readers of the old
+ *  copy to drain and then bring it up to date. A removed driver is released
+ *  only once neither copy references it.
+ */
+class HIDDriverRegistry {
+public:
+    static constexpr uint32_t Capacity {8};
+
+    bool init();
+    void deinit();
+
+    /**
+     *  Retain and publish driver, false if already present or full
+     */
+    bool add(AsusHIDDriver *driver);
+
+    /**
+     *  Unpublish and release driver, false if not present
+     */
+    bool remove(IOService *driver);
+
+    /**
+     *  Unpublish and release all drivers
+     */
+    void removeAll();
+
+    /**
+     *  Call function for every published driver without taking locks.
+     *  Drivers stay retained for the duration of the call.
+     */
+    template <typename F>
+    void forEach(F function) {
+        uint32_t index = enter();
+        const Snapshot &snapshot = slots[index];
+        for (uint32_t i = 0; i < snapshot.count; i++)
+            function(snapshot.drivers[i]);
+        leave(index);
+    }
+
+private:
+    struct Snapshot {
+        AsusHIDDriver *drivers[Capacity] {};
+        uint32_t count {0};
+    };
+
+    Snapshot slots[2];
+    _Atomic(uint32_t) current = ATOMIC_VAR_INIT(0);
+    _Atomic(uint32_t) readers[2] = {ATOMIC_VAR_INIT(0), ATOMIC_VAR_INIT(0)};
+
+    /**
+     *  Serializes writers
+     */
+    IOLock *writeLock {nullptr};
+
+    uint32_t enter() {
+        while (true) {
+            uint32_t index = atomic_load_explicit(&current, memory_order_seq_cst);
+            atomic_fetch_add_explicit(&readers[index], 1, memory_order_seq_cst);
+            // Writer may have flipped before our count became visible, retry on the new copy
+            if (atomic_load_explicit(&current, memory_order_seq_cst) == index)
+                return index;
+            atomic_fetch_sub_explicit(&readers[index], 1, memory_order_release);
+        }
+    }
+
+    void leave(uint32_t index) {
+        atomic_fetch_sub_explicit(&readers[index], 1, memory_order_release);
+    }
+
+    void waitForReaders(uint32_t index);
+
+    /**
+     *  Publish next to both copies, called with writeLock held
+     */
+    void publish(const Snapshot &next);
+};
+
+#endif /* HIDDriverRegistry_hpp */
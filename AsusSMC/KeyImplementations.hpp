@@ -11,6 +11,10 @@
 #include <IOKit/acpi/IOACPIPlatformDevice.h>
 #include <VirtualSMCSDK/kern_vsmcapi.hpp>
 #include "AsusHIDDriver.hpp"
+#include "ALSValue.hpp"
+#include "BacklightLevels.hpp"
+
+class AsusSMC;
 
 /**
  *  Key name definitions for VirtualSMC
@@ -28,26 +32,8 @@ static constexpr SMC_KEY KeyMSLD = SMC_MAKE_IDENTIFIER('M','S','L','D');
 class ALSForceBits : public VirtualSMCValue {
 public:
     /**
-     *  Each "1" bit in gui8ALSForced indicates that a certain writable ALS
-     *  variable has been overridden (i.e., forced) by the host OS or
-     *  host diagnostics, and that variable should not be written by the SMC
-     *  again until the applicable bit is cleared in gui8ALSForced.
-     *  Currently, the used bits are:
-     *      Bit 0 protects gui16ALSScale
-     *      Bit 1 protects ui16Chan0 and ui16Chan1 of aalsvALSData
-     *      Bit 2 protects gui16ALSLux
-     *      Bit 3 protects fHighGain of aalsvALSData
-     *      Bit 4 protects gai16ALSTemp[MAX_ALS_SENSORS]
-     *  All other bits are reserved and should be cleared to 0.
+     *  See kALSForce* in ALSValue.hpp
      */
-    enum {
-        kALSForceScale      = 1,
-        kALSForceChan       = 2,
-        kALSForceLux        = 4,
-        kALSForceHighGain   = 8,
-        kALSForceTemp       = 16
-    };
-
     uint8_t bits() { return data[0]; }
 };
 
@@ -100,37 +86,7 @@ protected:
     SMC_RESULT readAccess() override;
 
 public:
-    /**
-     *  Contains latest ambient light info from 1 sensor
-     */
-    struct PACKED Value {
-        /**
-         *  If TRUE, data in this struct is valid.
-         */
-        bool valid {false};
-
-        /**
-         *  If TRUE, ui16Chan0/1 are high-gain readings.
-         *  If FALSE, ui16Chan0/1 are low-gain readings.
-         */
-        bool highGain {true};
-
-        /**
-         *  I2C channel 0 data or analog(ADC) data.
-         */
-        uint16_t chan0 {0};
-
-        /**
-         *  I2C channel 1 data.
-         */
-        uint16_t chan1 {0};
-
-        /**
-         * The following field only exists on systems that send ALS change notifications to the OS:
-         * Room illumination in lux, FP18.14.
-         */
-        uint32_t roomLux {0};
-    };
+    using Value = ALSValue;
 
     SMCALSValue(_Atomic(uint32_t) *currentLux, ALSForceBits *forceBits) :
     currentLux(currentLux), forceBits(forceBits) {}
@@ -138,8 +94,7 @@ public:
 
 class SMCKBrdBLightValue : public VirtualSMCValue {
 protected:
-    IOACPIPlatformDevice *atkDevice {nullptr};
-    OSSet *_hidDrivers {nullptr};
+    AsusSMC *smc {nullptr};
 
 public:
     /**
@@ -154,7 +109,7 @@ public:
         uint8_t val2 {1};
     };
 
-    SMCKBrdBLightValue(IOACPIPlatformDevice *atkDevice, OSSet *_hidDrivers): atkDevice(atkDevice), _hidDrivers(_hidDrivers) {}
+    SMCKBrdBLightValue(AsusSMC *smc): smc(smc) {}
 
     SMC_RESULT update(const SMC_DATA *src) override;
 };
@@ -0,0 +1,85 @@
+//
+//  PanelBacklight.cpp
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#include "PanelBacklight.hpp"
+#include <VirtualSMCSDK/kern_vsmcapi.hpp>
+
+bool readPanelBrightness(IOService *display, uint32_t &value, uint32_t &min, uint32_t &max) {
+    OSDictionary *ioDisplayParaDict = OSDynamicCast(OSDictionary, display->getProperty("IODisplayParameters"));
+    if (!ioDisplayParaDict) {
+        DBGLOG("atk", "Failed to find dictionary IODisplayParameters");
+        return false;
+    }
+
+    OSDictionary *brightnessDict = OSDynamicCast(OSDictionary, ioDisplayParaDict->getObject("brightness"));
+    if (!brightnessDict) {
+        DBGLOG("atk", "Failed to find dictionary brightness");
+        return false;
+    }
+
+    OSNumber *brightnessValue = OSDynamicCast(OSNumber, brightnessDict->getObject("value"));
+    OSNumber *brightnessMin = OSDynamicCast(OSNumber, brightnessDict->getObject("min"));
+    OSNumber *brightnessMax = OSDynamicCast(OSNumber, brightnessDict->getObject("max"));
+    if (!brightnessValue || !brightnessMin || !brightnessMax) {
+        DBGLOG("atk", "Failed to read brightness value");
+        return false;
+    }
+
+    value = brightnessValue->unsigned32BitValue();
+    min = brightnessMin->unsigned32BitValue();
+    max = brightnessMax->unsigned32BitValue();
+    return true;
+}
+
+bool writePanelBrightness(IOService *display, uint32_t value, uint32_t min, uint32_t max) {
+    if (value < min)
+        value = min;
+    if (value > max)
+        value = max;
+
+    bool result = false;
+    OSNumber *number = OSNumber::withNumber(value, 32);
+    OSDictionary *params = OSDictionary::withCapacity(1);
+    if (number && params) {
+        params->setObject("brightness", number);
+        result = display->setProperties(params) == kIOReturnSuccess;
+    }
+    OSSafeReleaseNULL(number);
+    OSSafeReleaseNULL(params);
+
+    if (result)
+        DBGLOG("atk", "Panel brightness set to %d", value);
+    else
+        SYSLOG("atk", "Failed to set panel brightness");
+    return result;
+}
+
+bool PanelBacklight::turnOff(IOService *display, bool direct) {
+    on = false;
+
+    // Read Panel brightness value to restore later with backlight toggle
+    uint32_t value, min, max;
+    if (!display || !readPanelBrightness(display, value, min, max))
+        return false;
+
+    saved = value;
+    savedMin = min;
+    savedMax = max;
+    savedValid = true;
+    savedSteps = panelBrightnessToSteps(value);
+    DBGLOG("atk", "Panel brightness value: %d, level: %d", value, savedSteps);
+
+    return direct && writePanelBrightness(display, min, min, max);
+}
+
+bool PanelBacklight::turnOn(IOService *display, bool direct) {
+    on = true;
+
+    bool restore = savedValid && direct && display;
+    savedValid = false;
+    return restore && writePanelBrightness(display, saved, savedMin, savedMax);
+}
@@ -0,0 +1,72 @@
+//
+//  PanelBacklight.hpp
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef PanelBacklight_hpp
+#define PanelBacklight_hpp
+
+#include <IOKit/IOService.h>
+#include "BacklightLevels.hpp"
+
+/**
+ *  Brightness value and range from the display IODisplayParameters
+ */
+bool readPanelBrightness(IOService *display, uint32_t &value, uint32_t &min, uint32_t &max);
+
+/**
+ *  Set IODisplayParameters brightness value clamped to min...max.
+ *  This bypasses the brightness keys, so macOS shows no brightness OSD and the
+ *  system brightness slider only follows once the display republishes its parameters.
+ */
+bool writePanelBrightness(IOService *display, uint32_t value, uint32_t min, uint32_t max);
+
+/**
+ *  Panel backlight toggled by Fn+F7.
+ *
+ *  Turning the panel off reads the brightness once and sets the minimum,
+ *  turning it on writes the saved brightness back, so each toggle is a single
+ *  display update. When that is not possible the caller emulates brightness keys.
+ */
+class PanelBacklight {
+public:
+    bool isOn() const { return on; }
+
+    /**
+     *  Save the brightness of display and set it to the minimum if direct.
+     *  False if the panel was not set and brightness keys have to be emulated.
+     */
+    bool turnOff(IOService *display, bool direct);
+
+    /**
+     *  Restore the saved brightness if direct, false if brightness keys have to be emulated
+     */
+    bool turnOn(IOService *display, bool direct);
+
+    /**
+     *  Brightness key presses restoring the saved brightness
+     */
+    uint32_t restoreSteps() const { return savedSteps; }
+
+    /**
+     *  Brightness was set by other means, which turns the panel back on
+     */
+    void brightnessChanged() {
+        on = true;
+        savedValid = false;
+    }
+
+private:
+    bool on {true};
+
+    /**
+     *  Brightness and range read when the panel was turned off
+     */
+    uint32_t saved {0}, savedMin {0}, savedMax {0};
+    bool savedValid {false};
+    uint32_t savedSteps {PanelBrightnessSteps};
+};
+
+#endif /* PanelBacklight_hpp */
@@ -5,8 +5,6 @@
 //  Copyright © 2018-2019 Le Bao Hiep. All rights reserved.
 //
 
-#define AsusSMCEventCode 0x8102
-
 #import <Cocoa/Cocoa.h>
 #import <CoreWLAN/CoreWLAN.h>
 #import <CoreServices/CoreServices.h>
@@ -15,7 +13,13 @@
 #import <sys/kern_event.h>
 #import "BezelServices.h"
 #import "OSD.h"
+#import "AsusSMCEvents.h"
 #include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <mach/mach_time.h>
 
 /*
  *    kAERestart        will cause system to restart
@@ -31,22 +35,62 @@ int IOBluetoothPreferenceGetControllerPowerState(void);
 
 static void *(*_BSDoGraphicWithMeterAndTimeout)(CGDirectDisplayID arg0, BSGraphic arg1, int arg2, float v, int timeout) = NULL;
 
-enum {
-    kevKeyboardBacklight = 1,
-    kevAirplaneMode = 2,
-    kevSleep = 3,
-    kevTouchpad = 4,
-};
-
-struct AsusSMCMessage {
-    int type;
-    int x;
-    int y;
-};
-
 const int kMaxDisplays = 16;
 u_int32_t vendorID = 0;
 
+// backlight OSD updates closer than one display refresh are merged
+const int64_t kOSDCoalesceInterval = NSEC_PER_SEC / 60;
+
+// slow actions (WiFi/Bluetooth power, AppleEvents) waiting or running,
+// further ones are dropped so intake and OSD never wait behind them
+const int kMaxSlowActions = 4;
+dispatch_queue_t slowQueue;
+atomic_int slowQueueDepth = 0;
+
+// loop statistics, printed on SIGUSR1
+atomic_uint slowActionsDropped = 0;
+atomic_ullong intakeMaxLatency = 0, slowActionMaxLatency = 0;
+
+// kernel events read from the socket vs. ones that were ours,
+// equal as long as the kernel filter works
+atomic_uint eventsReceived = 0, eventsRelevant = 0;
+
+uint64_t elapsedNanoseconds(uint64_t start) {
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) mach_timebase_info(&timebase);
+    return (mach_absolute_time() - start) * timebase.numer / timebase.denom;
+}
+
+void updateMaxLatency(atomic_ullong *max, uint64_t latency) {
+    unsigned long long current = atomic_load(max);
+    while (latency > current && !atomic_compare_exchange_weak(max, &current, latency));
+}
+
+void runSlowAction(void (^action)(void)) {
+    if (atomic_fetch_add(&slowQueueDepth, 1) >= kMaxSlowActions) {
+        atomic_fetch_sub(&slowQueueDepth, 1);
+        atomic_fetch_add(&slowActionsDropped, 1);
+        printf("slow action queue full, dropping action\n");
+        return;
+    }
+
+    dispatch_async(slowQueue, ^{
+        uint64_t start = mach_absolute_time();
+        action();
+        updateMaxLatency(&slowActionMaxLatency, elapsedNanoseconds(start));
+        atomic_fetch_sub(&slowQueueDepth, 1);
+    });
+}
+
+void printStatistics() {
+    printf("slow queue depth %d, dropped %u, max slow action %llu us, max intake %llu us\n",
+           atomic_load(&slowQueueDepth), atomic_load(&slowActionsDropped),
+           atomic_load(&slowActionMaxLatency) / 1000, atomic_load(&intakeMaxLatency) / 1000);
+    printf("kernel events received %u, relevant %u\n",
+           atomic_load(&eventsReceived), atomic_load(&eventsRelevant));
+    fflush(stdout);
+}
+
 bool _loadBezelServices() {
     // Load BezelServices framework
     void *handle = dlopen("/System/Library/PrivateFrameworks/BezelServices.framework/Versions/A/BezelServices", RTLD_GLOBAL);
@@ -90,14 +134,35 @@ OSStatus MDSendAppleEventToSystemProcess(AEEventID eventToSendID) {
     return status;
 }
 
+// display ID and OSDManager are looked up once and dropped on screen changes
+// ->only touched on the main queue
+CGDirectDisplayID cachedDisplayId = kCGNullDirectDisplay;
+OSDManager *cachedOSDManager = nil;
+
+void displayReconfigured(CGDirectDisplayID display, CGDisplayChangeSummaryFlags flags, void *userInfo) {
+    if (flags & kCGDisplayBeginConfigurationFlag) return;
+    cachedDisplayId = kCGNullDirectDisplay;
+    cachedOSDManager = nil;
+}
+
+CGDirectDisplayID currentDisplayId() {
+    if (cachedDisplayId == kCGNullDirectDisplay)
+        cachedDisplayId = [NSScreen.mainScreen.deviceDescription [@"NSScreenNumber"] unsignedIntValue];
+    return cachedDisplayId;
+}
+
+OSDManager *osdManager() {
+    if (!cachedOSDManager)
+        cachedOSDManager = [NSClassFromString(@"OSDManager") sharedManager];
+    return cachedOSDManager;
+}
+
 void showBezelServices(BSGraphic image, float filled) {
-    CGDirectDisplayID currentDisplayId = [NSScreen.mainScreen.deviceDescription [@"NSScreenNumber"] unsignedIntValue];
-    _BSDoGraphicWithMeterAndTimeout(currentDisplayId, image, 0x0, filled, 1);
+    _BSDoGraphicWithMeterAndTimeout(currentDisplayId(), image, 0x0, filled, 1);
 }
 
 void showOSD(OSDGraphic image, int filled, int total) {
-    CGDirectDisplayID currentDisplayId = [NSScreen.mainScreen.deviceDescription [@"NSScreenNumber"] unsignedIntValue];
-    [[NSClassFromString(@"OSDManager") sharedManager] showImage:image onDisplayID:currentDisplayId priority:OSDPriorityDefault msecUntilFade:1000 filledChiclets:filled totalChiclets:total locked:NO];
+    [osdManager() showImage:image onDisplayID:currentDisplayId() priority:OSDPriorityDefault msecUntilFade:1000 filledChiclets:filled totalChiclets:total locked:NO];
 }
 
 void showKBoardBLightStatus(int level, int max) {
@@ -117,15 +182,49 @@ void showKBoardBLightStatus(int level, int max) {
 }
 
 void goToSleep() {
-    if (_BSDoGraphicWithMeterAndTimeout != NULL) // El Capitan and probably older systems
-        MDSendAppleEventToSystemProcess(kAESleep);
-    else {
+    if (_BSDoGraphicWithMeterAndTimeout != NULL) { // El Capitan and probably older systems
+        runSlowAction(^{
+            MDSendAppleEventToSystemProcess(kAESleep);
+        });
+    } else {
         // Sierra+
-        CGDirectDisplayID currentDisplayId = [NSScreen.mainScreen.deviceDescription [@"NSScreenNumber"] unsignedIntValue];
-        [[NSClassFromString(@"OSDManager") sharedManager] showImage:OSDGraphicSleep onDisplayID:currentDisplayId priority:OSDPriorityDefault msecUntilFade:1000];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [osdManager() showImage:OSDGraphicSleep onDisplayID:currentDisplayId() priority:OSDPriorityDefault msecUntilFade:1000];
+        });
     }
 }
 
+// latest backlight level waiting for the OSD
+// ->only touched on the main queue
+int pendingBacklightLevel, pendingBacklightMax;
+BOOL backlightUpdateScheduled = NO;
+dispatch_time_t lastBacklightUpdate = 0;
+
+void flushKBoardBLightStatus() {
+    backlightUpdateScheduled = NO;
+    lastBacklightUpdate = dispatch_time(DISPATCH_TIME_NOW, 0);
+    showKBoardBLightStatus(pendingBacklightLevel, pendingBacklightMax);
+}
+
+void queueKBoardBLightStatus(int level, int max) {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        pendingBacklightLevel = level;
+        pendingBacklightMax = max;
+        if (backlightUpdateScheduled) return;
+
+        // first level of a burst is shown right away, later ones once per refresh interval
+        dispatch_time_t next = dispatch_time(lastBacklightUpdate, kOSDCoalesceInterval);
+        if (lastBacklightUpdate == 0 || dispatch_time(DISPATCH_TIME_NOW, 0) >= next) {
+            flushKBoardBLightStatus();
+        } else {
+            backlightUpdateScheduled = YES;
+            dispatch_after(next, dispatch_get_main_queue(), ^{
+                flushKBoardBLightStatus();
+            });
+        }
+    });
+}
+
 BOOL airplaneModeEnabled = NO, lastWifiState;
 int lastBluetoothState;
 void toggleAirplaneMode() {
@@ -145,6 +244,79 @@ void toggleAirplaneMode() {
     }
 }
 
+void handleRecord(const struct AsusSMCEventRecord *record) {
+#ifdef DEBUG
+    printf("seq:%u type:%u x:%d y:%d\n", record->seq, record->type, record->x, record->y);
+#endif
+
+    switch (record->type) {
+        case kevKeyboardBacklight:
+            queueKBoardBLightStatus(record->x, record->y);
+            break;
+        case kevAirplaneMode:
+            runSlowAction(^{
+                toggleAirplaneMode();
+            });
+            break;
+        case kevSleep:
+            goToSleep();
+            break;
+        default:
+            printf("unknown type %u\n", record->type);
+    }
+}
+
+uint32_t nextSeq = 0;
+BOOL seqValid = NO;
+
+void handleEvent(const struct kern_event_msg *kernEventMsg) {
+    atomic_fetch_add(&eventsReceived, 1);
+
+    //only care about our events
+    if (kernEventMsg->vendor_code != vendorID || kernEventMsg->kev_class != AsusSMCEventClass ||
+        kernEventMsg->kev_subclass != AsusSMCEventSubclass || kernEventMsg->event_code != AsusSMCEventCode)
+        return;
+
+    atomic_fetch_add(&eventsRelevant, 1);
+
+    //payload begins right after the kernel event header
+    size_t dataSize = kernEventMsg->total_size - KEV_MSG_HEADER_SIZE;
+    const struct AsusSMCEventHeader *header;
+    const struct AsusSMCEventRecord *records;
+    switch (AsusSMCEventDecode(&kernEventMsg->event_data[0], dataSize, &header, &records)) {
+        case AsusSMCEventDecodeOK:
+            break;
+        case AsusSMCEventDecodeVersion:
+            printf("unsupported protocol version %u\n", header->version);
+            return;
+        default:
+            printf("short frame in %zu bytes\n", dataSize);
+            return;
+    }
+
+    for (uint16_t i = 0; i < header->count; i++) {
+        if (seqValid && records[i].seq != nextSeq)
+            printf("lost %u records (kext dropped %u)\n", records[i].seq - nextSeq, header->dropped);
+        nextSeq = records[i].seq + 1;
+        seqValid = YES;
+        handleRecord(&records[i]);
+    }
+}
+
+void handleFrames(const char *buffer, ssize_t length) {
+    //a read may hold several events back to back
+    ssize_t offset = 0;
+    while (length - offset >= KEV_MSG_HEADER_SIZE) {
+        const struct kern_event_msg *kernEventMsg = (const struct kern_event_msg *)(buffer + offset);
+        if (kernEventMsg->total_size < KEV_MSG_HEADER_SIZE || kernEventMsg->total_size > length - offset) {
+            printf("short frame, %u of %zd bytes\n", kernEventMsg->total_size, length - offset);
+            return;
+        }
+        handleEvent(kernEventMsg);
+        offset += kernEventMsg->total_size;
+    }
+}
+
 int main(int argc, const char *argv[]) {
     @autoreleasepool {
         printf("daemon started...\n");
@@ -158,85 +330,87 @@ int main(int argc, const char *argv[]) {
 
         //create system socket to receive kernel event data
         systemSocket = socket(PF_SYSTEM, SOCK_RAW, SYSPROTO_EVENT);
+        if (systemSocket < 0) {
+            perror("socket");
+            return 1;
+        }
 
         //struct for vendor code
         // ->set via call to ioctl/SIOCGKEVVENDOR
         struct kev_vendor_code vendorCode = {0};
 
         //set vendor name string
-        strncpy(vendorCode.vendor_string, "com.hieplpvip", KEV_VENDOR_CODE_MAX_STR_LEN);
+        strncpy(vendorCode.vendor_string, AsusSMCVendor, KEV_VENDOR_CODE_MAX_STR_LEN);
 
         //get vendor name -> vendor code mapping
         // ->vendor id, saved in 'vendorCode' variable
-        ioctl(systemSocket, SIOCGKEVVENDOR, &vendorCode);
+        if (ioctl(systemSocket, SIOCGKEVVENDOR, &vendorCode) != 0) {
+            perror("SIOCGKEVVENDOR");
+            return 1;
+        }
+        vendorID = vendorCode.vendor_code;
 
         //struct for kernel request
         // ->set filtering options
         struct kev_request kevRequest = {0};
 
         //init filtering options
-        // ->only interested in objective-see's events kevRequest.vendor_code = vendorCode.vendor_code;
+        // ->only interested in our events
+        kevRequest.vendor_code = vendorCode.vendor_code;
 
-        //...any class
-        kevRequest.kev_class = KEV_ANY_CLASS;
+        //...our class
+        kevRequest.kev_class = AsusSMCEventClass;
 
-        //...any subclass
-        kevRequest.kev_subclass = KEV_ANY_SUBCLASS;
+        //...our subclass
+        kevRequest.kev_subclass = AsusSMCEventSubclass;
 
         //tell kernel what we want to filter on
-        ioctl(systemSocket, SIOCSKEVFILT, &kevRequest);
-
-        //bytes received from system socket
-        ssize_t bytesReceived = -1;
-
-        //message from kext
-        // ->size is cumulation of header, struct, and max length of a proc path
-        char kextMsg[KEV_MSG_HEADER_SIZE + sizeof(struct AsusSMCMessage)] = {0};
-
-        struct AsusSMCMessage *message = NULL;
+        if (ioctl(systemSocket, SIOCSKEVFILT, &kevRequest) != 0) {
+            perror("SIOCSKEVFILT");
+            return 1;
+        }
 
-        while (YES) {
-            //printf("listening...\n");
+        //reads are driven by a dispatch source, never block in recv
+        if (fcntl(systemSocket, F_SETFL, fcntl(systemSocket, F_GETFL) | O_NONBLOCK) != 0) {
+            perror("fcntl");
+            return 1;
+        }
 
-            bytesReceived = recv(systemSocket, kextMsg, sizeof(kextMsg), 0);
+        slowQueue = dispatch_queue_create("com.hieplpvip.AsusSMCDaemon.slow", DISPATCH_QUEUE_SERIAL);
+        dispatch_queue_t intakeQueue = dispatch_queue_create("com.hieplpvip.AsusSMCDaemon.intake", dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_USER_INTERACTIVE, 0));
 
-            if (bytesReceived != sizeof(kextMsg)) continue;
+        dispatch_source_t intakeSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, systemSocket, 0, intakeQueue);
+        dispatch_source_set_event_handler(intakeSource, ^{
+            //room for several events per read
+            // ->aligned for kern_event_msg access
+            static uint32_t kextMsg[1024];
 
-            //struct for broadcast data from the kext
-            struct kern_event_msg *kernEventMsg = {0};
+            uint64_t start = mach_absolute_time();
 
-            //type cast
-            // ->to access kev_event_msg header
-            kernEventMsg = (struct kern_event_msg*)kextMsg;
+            //drain everything that queued up
+            ssize_t bytesReceived;
+            while ((bytesReceived = recv(systemSocket, kextMsg, sizeof(kextMsg), 0)) > 0)
+                handleFrames((const char *)kextMsg, bytesReceived);
 
-            //only care about 'process began' events
-            if (AsusSMCEventCode != kernEventMsg->event_code) {
-                //skip
-                continue;
-            }
+            if (bytesReceived < 0 && errno != EAGAIN && errno != EINTR)
+                perror("recv");
 
-            //printf("new message\n");
+            updateMaxLatency(&intakeMaxLatency, elapsedNanoseconds(start));
+        });
+        dispatch_resume(intakeSource);
 
-            //typecast custom data
-            // ->begins right after header
-            message = (struct AsusSMCMessage*)&kernEventMsg->event_data[0];
+        //report loop statistics on demand
+        signal(SIGUSR1, SIG_IGN);
+        dispatch_source_t statsSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, SIGUSR1, 0, dispatch_get_main_queue());
+        dispatch_source_set_event_handler(statsSource, ^{
+            printStatistics();
+        });
+        dispatch_resume(statsSource);
 
-            printf("type:%d x:%d y:%d\n", message->type, message->x, message->y);
+        //drop cached display on screen changes
+        CGDisplayRegisterReconfigurationCallback(displayReconfigured, NULL);
 
-            switch (message->type) {
-                case kevKeyboardBacklight:
-                    showKBoardBLightStatus(message->x, message->y);
-                    break;
-                case kevAirplaneMode:
-                    toggleAirplaneMode();
-                    break;
-                case kevSleep:
-                    goToSleep();
-                    break;
-                default:
-                    printf("unknown type %d\n", message->type);
-            }
-        }
+        CFRunLoopRun();
     }
 
     return 0;
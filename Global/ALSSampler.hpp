@@ -0,0 +1,165 @@
+//
+//  ALSSampler.hpp
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef ALSSampler_hpp
+#define ALSSampler_hpp
+
+#include <stdint.h>
+#include "ALSValue.hpp"
+
+/**
+ *  Smooths raw ALSS readings and decides how often to sample and when to notify macOS.
+ *  Integer only and free of IOKit dependencies, the caller supplies time in milliseconds.
+ */
+class ALSSampler {
+public:
+    /**
+     *  Median window, odd so the median is an actual sample
+     */
+    static constexpr uint32_t WindowSize {5};
+
+    /**
+     *  Sample interval while lux is changing
+     */
+    static constexpr uint32_t FastIntervalMS {250};
+
+    /**
+     *  Sample interval ceiling once lux is stable
+     */
+    static constexpr uint32_t StableIntervalMS {4000};
+
+    /**
+     *  Sample rate is recomputed over windows of this length
+     */
+    static constexpr uint32_t RateWindowMS {60000};
+
+    /**
+     *  Minimum change of filtered lux reported to macOS
+     */
+    uint32_t hysteresis {0};
+
+    /**
+     *  Minimum distance of a raw reading from filtered lux that counts as light moving.
+     *  Kept above sensor noise so steady light backs off to StableIntervalMS.
+     */
+    static constexpr uint32_t MinChangeLux {4};
+    uint32_t changeThreshold {MinChangeLux};
+
+    /**
+     *  Feed a raw reading
+     *
+     *  @param lux    raw ALSS value or ALSInvalidLux
+     *  @param nowMS  monotonic time in milliseconds
+     *  @return true if filtered lux changed enough to post SmcEventALSChange
+     */
+    bool addSample(uint32_t lux, uint64_t nowMS) {
+        samples++;
+        updateRate(nowMS);
+
+        if (lux == ALSInvalidLux) {
+            head = count = 0;
+            filtered = ALSInvalidLux;
+            interval = FastIntervalMS;
+        } else {
+            window[head] = lux;
+            head = (head + 1) % WindowSize;
+            if (count < WindowSize)
+                count++;
+            filtered = median();
+        }
+
+        // Raw reading away from what we report means light is moving, sample faster
+        if (alsLuxChanged(filtered, lux, movingThreshold())) {
+            interval = FastIntervalMS;
+        } else if (interval < StableIntervalMS) {
+            interval *= 2;
+            if (interval > StableIntervalMS)
+                interval = StableIntervalMS;
+        }
+
+        if (!alsLuxChanged(posted, filtered, hysteresis)) {
+            suppressed++;
+            return false;
+        }
+
+        posted = filtered;
+        interrupts++;
+        return true;
+    }
+
+    /**
+     *  Filtered lux to expose through ALV0
+     */
+    uint32_t lux() const { return filtered; }
+
+    /**
+     *  Delay until the next sample
+     *
+     *  @param stableMS  interval to use once lux is stable
+     */
+    uint32_t nextIntervalMS(uint32_t stableMS) const {
+        return interval < StableIntervalMS ? interval : stableMS;
+    }
+
+    uint32_t sampleCount() const { return samples; }
+    uint32_t interruptCount() const { return interrupts; }
+    uint32_t suppressedCount() const { return suppressed; }
+    uint32_t samplesPerMinute() const { return rate; }
+    uint32_t intervalMS() const { return interval; }
+
+private:
+    uint32_t window[WindowSize] {};
+    uint32_t head {0};
+    uint32_t count {0};
+
+    uint32_t filtered {ALSInvalidLux};
+    uint32_t posted {ALSInvalidLux};
+    uint32_t interval {FastIntervalMS};
+
+    uint32_t samples {0};
+    uint32_t interrupts {0};
+    uint32_t suppressed {0};
+
+    uint64_t rateStartMS {0};
+    uint32_t rateSamples {0};
+    uint32_t rate {0};
+
+    /**
+     *  Noise grows with light level, so allow 1/16 of filtered lux on top of the fixed floor
+     */
+    uint32_t movingThreshold() const {
+        uint32_t threshold = changeThreshold > hysteresis ? changeThreshold : hysteresis;
+        if (filtered != ALSInvalidLux && filtered / 16 > threshold)
+            threshold = filtered / 16;
+        return threshold;
+    }
+
+    uint32_t median() const {
+        uint32_t sorted[WindowSize];
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t v = window[i];
+            uint32_t j = i;
+            for (; j > 0 && sorted[j - 1] > v; j--)
+                sorted[j] = sorted[j - 1];
+            sorted[j] = v;
+        }
+        return sorted[count / 2];
+    }
+
+    void updateRate(uint64_t nowMS) {
+        if (rateSamples == 0)
+            rateStartMS = nowMS;
+        rateSamples++;
+        uint64_t elapsed = nowMS - rateStartMS;
+        if (elapsed >= RateWindowMS) {
+            rate = static_cast<uint32_t>(rateSamples * 60000ULL / elapsed);
+            rateSamples = 0;
+        }
+    }
+};
+
+#endif /* ALSSampler_hpp */
@@ -0,0 +1,119 @@
+//
+//  ALSValue.hpp
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef ALSValue_hpp
+#define ALSValue_hpp
+
+#include <stdint.h>
+
+/**
+ *  Each "1" bit in gui8ALSForced indicates that a certain writable ALS
+ *  variable has been overridden (i.e., forced) by the host OS or
+ *  host diagnostics, and that variable should not be written by the SMC
+ *  again until the applicable bit is cleared in gui8ALSForced.
+ *  Currently, the used bits are:
+ *      Bit 0 protects gui16ALSScale
+ *      Bit 1 protects ui16Chan0 and ui16Chan1 of aalsvALSData
+ *      Bit 2 protects gui16ALSLux
+ *      Bit 3 protects fHighGain of aalsvALSData
+ *      Bit 4 protects gai16ALSTemp[MAX_ALS_SENSORS]
+ *  All other bits are reserved and should be cleared to 0.
+ */
+enum {
+    kALSForceScale      = 1,
+    kALSForceChan       = 2,
+    kALSForceLux        = 4,
+    kALSForceHighGain   = 8,
+    kALSForceTemp       = 16
+};
+
+/**
+ *  Lux value reported by ACPI when ALSS evaluation failed
+ */
+static constexpr uint32_t ALSInvalidLux = 0xFFFFFFFF;
+
+/**
+ *  Whether lux moved far enough from the last posted value to notify macOS.
+ *  Sensor failing or recovering always counts as a change.
+ */
+inline bool alsLuxChanged(uint32_t posted, uint32_t lux, uint32_t hysteresis) {
+    if (posted == ALSInvalidLux || lux == ALSInvalidLux)
+        return posted != lux;
+    uint32_t delta = lux > posted ? lux - posted : posted - lux;
+    return delta > hysteresis;
+}
+
+/**
+ *  Contains latest ambient light info from 1 sensor
+ */
+struct __attribute__((packed)) ALSValue {
+    /**
+     *  If TRUE, data in this struct is valid.
+     */
+    bool valid {false};
+
+    /**
+     *  If TRUE, ui16Chan0/1 are high-gain readings.
+     *  If FALSE, ui16Chan0/1 are low-gain readings.
+     */
+    bool highGain {true};
+
+    /**
+     *  I2C channel 0 data or analog(ADC) data.
+     */
+    uint16_t chan0 {0};
+
+    /**
+     *  I2C channel 1 data.
+     */
+    uint16_t chan1 {0};
+
+    /**
+     * The following field only exists on systems that send ALS change notifications to the OS:
+     * Room illumination in lux, FP18.14.
+     */
+    uint32_t roomLux {0};
+};
+
+/**
+ *  SMC stores multi-byte values big endian
+ */
+inline uint16_t alsHostToBig16(uint16_t v) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_bswap16(v);
+#else
+    return v;
+#endif
+}
+
+inline uint32_t alsHostToBig32(uint32_t v) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_bswap32(v);
+#else
+    return v;
+#endif
+}
+
+/**
+ *  Fill ALV0 value with lux obtained from ACPI, leaving forced fields untouched
+ */
+inline void updateALSValue(ALSValue *value, uint32_t lux, uint8_t forceBits) {
+    if (lux == ALSInvalidLux) {
+        value->valid = false;
+        return;
+    }
+
+    value->valid = true;
+    if (!(forceBits & kALSForceHighGain))
+        value->highGain = true;
+    if (!(forceBits & kALSForceChan))
+        value->chan0 = alsHostToBig16(lux);
+    if (!(forceBits & kALSForceLux))
+        value->roomLux = alsHostToBig32(lux << 14);
+}
+
+#endif /* ALSValue_hpp */
@@ -0,0 +1,208 @@
+//
+//  ATKEvents.hpp
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef ATKEvents_hpp
+#define ATKEvents_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "HIDUsageTables.h"
+
+/**
+ *  This header must stay free of IOKit dependencies,
+ *  only plain integer decoding of ATK notify codes lives here.
+ */
+
+const uint8_t NOTIFY_BRIGHTNESS_UP_MIN = 0x10;
+const uint8_t NOTIFY_BRIGHTNESS_UP_MAX = 0x1F;
+
+const uint8_t NOTIFY_BRIGHTNESS_DOWN_MIN = 0x20;
+const uint8_t NOTIFY_BRIGHTNESS_DOWN_MAX = 0x2F;
+
+/**
+ *  Consumer page usages (HID Usage Tables, page 0x0C)
+ */
+enum {
+    kATKUsage_Csmr_ScanNextTrack     = 0xB5,
+    kATKUsage_Csmr_ScanPreviousTrack = 0xB6,
+    kATKUsage_Csmr_PlayOrPause       = 0xCD,
+    kATKUsage_Csmr_Mute              = 0xE2,
+    kATKUsage_Csmr_VolumeIncrement   = 0xE9,
+    kATKUsage_Csmr_VolumeDecrement   = 0xEA,
+};
+
+/**
+ *  What AsusSMC does in response to an ATK notify code
+ */
+enum class ATKAction : uint8_t {
+    None,
+    ConsumerKey,
+    TopCaseKey,
+    DisplayOff,
+    TouchpadToggle,
+    Sleep,
+    ALSToggle,
+    AirplaneMode,
+    KeyboardBacklightDown,
+    KeyboardBacklightUp,
+    ALSNotify,
+    PanelBrightness,
+    ActionCount
+};
+
+/**
+ *  Action names accepted in ATKEventMap personality overrides, indexed by ATKAction
+ */
+static constexpr const char *ATKActionNames[] = {
+    "None",
+    "ConsumerKey",
+    "TopCaseKey",
+    "DisplayOff",
+    "TouchpadToggle",
+    "Sleep",
+    "ALSToggle",
+    "AirplaneMode",
+    "KeyboardBacklightDown",
+    "KeyboardBacklightUp",
+    "ALSNotify",
+    "PanelBrightness",
+};
+
+static_assert(sizeof(ATKActionNames) / sizeof(ATKActionNames[0]) == static_cast<size_t>(ATKAction::ActionCount), "ATKActionNames is out of sync with ATKAction");
+
+inline bool atkActionFromName(const char *name, ATKAction &action) {
+    for (uint8_t i = 0; i < static_cast<uint8_t>(ATKAction::ActionCount); i++) {
+        if (!strcmp(name, ATKActionNames[i])) {
+            action = static_cast<ATKAction>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+struct ATKEvent {
+    ATKAction action {ATKAction::None};
+
+    /**
+     *  How many times the key is pressed and released
+     */
+    uint8_t repeat {1};
+
+    /**
+     *  HID usage to post for ConsumerKey/TopCaseKey actions,
+     *  fallback key for PanelBrightness when no backlight display is found
+     */
+    uint16_t usage {0};
+
+    /**
+     *  Panel level for PanelBrightness actions
+     */
+    uint8_t level {0};
+};
+
+/**
+ *  Brightness notify codes carry the new panel level in the low nibble
+ */
+constexpr uint8_t atkBrightnessLevel(uint32_t code) {
+    return static_cast<uint8_t>(code & 0xF);
+}
+
+constexpr bool isATKBrightnessCode(uint32_t code) {
+    return code >= NOTIFY_BRIGHTNESS_UP_MIN && code <= NOTIFY_BRIGHTNESS_DOWN_MAX;
+}
+
+/**
+ *  ATK notify codes are 8-bit
+ */
+static constexpr uint32_t ATKEventCount = 256;
+
+constexpr ATKEvent decodeATKEvent(uint32_t code) {
+    switch (code) {
+        case 0x30: // Volume up
+            return {ATKAction::ConsumerKey, 1, kATKUsage_Csmr_VolumeIncrement};
+        case 0x31: // Volume down
+            return {ATKAction::ConsumerKey, 1, kATKUsage_Csmr_VolumeDecrement};
+        case 0x32: // Mute
+            return {ATKAction::ConsumerKey, 1, kATKUsage_Csmr_Mute};
+
+        // Media buttons
+        case 0x40:
+        case 0x8A:
+            return {ATKAction::ConsumerKey, 1, kATKUsage_Csmr_ScanPreviousTrack};
+        case 0x41:
+        case 0x82:
+            return {ATKAction::ConsumerKey, 1, kATKUsage_Csmr_ScanNextTrack};
+        case 0x45:
+        case 0x5C:
+            return {ATKAction::ConsumerKey, 1, kATKUsage_Csmr_PlayOrPause};
+
+        case 0x33: // hardwired On
+        case 0x34: // hardwired Off
+        case 0x35: // Soft Event, Fn + F7
+            return {ATKAction::DisplayOff, 1, 0};
+
+        case 0x61: // Video Mirror
+            return {ATKAction::TopCaseKey, 1, kHIDUsage_AV_TopCase_VideoMirror};
+
+        case 0x6B: // Fn + F9, Touchpad On/Off
+            return {ATKAction::TouchpadToggle, 1, 0};
+
+        case 0x5E:
+            return {ATKAction::Sleep, 1, 0};
+
+        case 0x7A: // Fn + A, ALS Sensor
+            return {ATKAction::ALSToggle, 1, 0};
+
+        case 0x7D: // Airplane mode
+            return {ATKAction::AirplaneMode, 1, 0};
+
+        case 0xC5: // Keyboard Backlight Down
+            return {ATKAction::KeyboardBacklightDown, 1, 0};
+
+        case 0xC4: // Keyboard Backlight Up
+            return {ATKAction::KeyboardBacklightUp, 1, 0};
+
+        case 0xC6:
+        case 0xC7: // ALS Notifcations
+            return {ATKAction::ALSNotify, 1, 0};
+
+        case 0x57: // AC disconnected
+        case 0x58: // AC connected
+            // ignore silently
+            return {};
+
+        default:
+            if (code >= NOTIFY_BRIGHTNESS_DOWN_MIN && code <= NOTIFY_BRIGHTNESS_DOWN_MAX)
+                return {ATKAction::PanelBrightness, 1, kHIDUsage_AV_TopCase_BrightnessDown, atkBrightnessLevel(code)};
+            if (code >= NOTIFY_BRIGHTNESS_UP_MIN && code <= NOTIFY_BRIGHTNESS_UP_MAX)
+                return {ATKAction::PanelBrightness, 1, kHIDUsage_AV_TopCase_BrightnessUp, atkBrightnessLevel(code)};
+            return {};
+    }
+}
+
+struct ATKEventTable {
+    ATKEvent events[ATKEventCount];
+};
+
+constexpr ATKEventTable makeATKEventTable() {
+    ATKEventTable table {};
+    for (uint32_t code = 0; code < ATKEventCount; code++)
+        table.events[code] = decodeATKEvent(code);
+    return table;
+}
+
+/**
+ *  Default code -> action mapping, built at compile time.
+ *  Models with non-standard codes patch a copy of it from the IOKit personality.
+ */
+static constexpr ATKEventTable DefaultATKEventTable = makeATKEventTable();
+
+static_assert(DefaultATKEventTable.events[0x35].action == ATKAction::DisplayOff, "ATK event table is not built at compile time");
+static_assert(DefaultATKEventTable.events[0x2A].level == 0xA, "ATK brightness levels are not decoded");
+
+#endif /* ATKEvents_hpp */
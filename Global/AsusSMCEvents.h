@@ -0,0 +1,114 @@
+//
+//  AsusSMCEvents.h
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef _AsusSMCEvents_h
+#define _AsusSMCEvents_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  Kernel event protocol between KernEventServer and AsusSMCDaemon.
+ *  Shared by the kext and the daemon, keep it plain C.
+ *
+ *  Every kernel event carries an AsusSMCEventHeader followed by
+ *  header.count AsusSMCEventRecord entries.
+ */
+
+#define AsusSMCVendor "com.hieplpvip"
+#define AsusSMCEventCode 0x8102
+
+/**
+ *  Vendor scoped class/subclass, lets the daemon filter in the kernel
+ *  instead of receiving every kernel event on the system
+ */
+#define AsusSMCEventClass 1
+#define AsusSMCEventSubclass 1
+
+/**
+ *  Bump when the layout of the header or records changes
+ */
+#define AsusSMCEventVersion 1
+
+/**
+ *  kev_msg_post rejects events larger than one mbuf,
+ *  this many records always fit together with the header
+ */
+#define AsusSMCEventMaxRecords 6
+
+enum {
+    kevKeyboardBacklight = 1,
+    kevAirplaneMode = 2,
+    kevSleep = 3,
+    kevTouchpad = 4,
+};
+
+struct AsusSMCEventHeader {
+    uint16_t version;
+    uint16_t count;
+
+    /**
+     *  Total records lost in the kext because events could not be posted
+     */
+    uint32_t dropped;
+};
+
+struct AsusSMCEventRecord {
+    /**
+     *  Increments by one for every record, gaps mean lost records
+     */
+    uint32_t seq;
+    uint32_t type;
+
+    /**
+     *  Uptime in ns when the record was queued
+     */
+    uint64_t timestamp;
+    int32_t x;
+    int32_t y;
+};
+
+#ifdef __cplusplus
+static_assert(sizeof(AsusSMCEventHeader) == 8, "AsusSMCEventHeader layout changed");
+static_assert(sizeof(AsusSMCEventRecord) == 24, "AsusSMCEventRecord layout changed");
+#else
+_Static_assert(sizeof(struct AsusSMCEventHeader) == 8, "AsusSMCEventHeader layout changed");
+_Static_assert(sizeof(struct AsusSMCEventRecord) == 24, "AsusSMCEventRecord layout changed");
+#endif
+
+/**
+ *  Size of an event payload carrying count records
+ */
+#define AsusSMCEventSize(count) (sizeof(struct AsusSMCEventHeader) + (count) * sizeof(struct AsusSMCEventRecord))
+
+enum {
+    AsusSMCEventDecodeOK = 0,
+    AsusSMCEventDecodeShort,
+    AsusSMCEventDecodeVersion,
+};
+
+/**
+ *  Validate the payload of one kernel event and locate its header and records
+ */
+static inline int AsusSMCEventDecode(const void *payload, size_t size,
+                                     const struct AsusSMCEventHeader **header,
+                                     const struct AsusSMCEventRecord **records) {
+    if (size < sizeof(struct AsusSMCEventHeader))
+        return AsusSMCEventDecodeShort;
+
+    *header = (const struct AsusSMCEventHeader *)payload;
+    if ((*header)->version != AsusSMCEventVersion)
+        return AsusSMCEventDecodeVersion;
+
+    if ((*header)->count > AsusSMCEventMaxRecords || AsusSMCEventSize((*header)->count) > size)
+        return AsusSMCEventDecodeShort;
+
+    *records = (const struct AsusSMCEventRecord *)(*header + 1);
+    return AsusSMCEventDecodeOK;
+}
+
+#endif /* _AsusSMCEvents_h */
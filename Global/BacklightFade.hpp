@@ -0,0 +1,155 @@
+//
+//  BacklightFade.hpp
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef BacklightFade_hpp
+#define BacklightFade_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ *  Interpolation curves for keyboard backlight fades
+ */
+enum class FadeCurve : uint8_t {
+    Linear,
+    Smoothstep,
+    CurveCount
+};
+
+static constexpr const char *FadeCurveNames[] = {
+    "Linear",
+    "Smoothstep",
+};
+
+static_assert(sizeof(FadeCurveNames) / sizeof(FadeCurveNames[0]) == static_cast<size_t>(FadeCurve::CurveCount), "FadeCurveNames is out of sync with FadeCurve");
+
+inline bool fadeCurveFromName(const char *name, FadeCurve &curve) {
+    for (uint8_t i = 0; i < static_cast<uint8_t>(FadeCurve::CurveCount); i++) {
+        if (!strcmp(name, FadeCurveNames[i])) {
+            curve = static_cast<FadeCurve>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ *  Fade progress is 16.16 fixed-point, 0...FadeOne
+ */
+static constexpr uint32_t FadeOne = 1U << 16;
+
+constexpr uint32_t applyFadeCurve(FadeCurve curve, uint32_t t) {
+    // smoothstep 3t^2 - 2t^3
+    return curve == FadeCurve::Smoothstep ?
+        static_cast<uint32_t>(static_cast<uint64_t>(t) * t / FadeOne * (3 * FadeOne - 2 * t) / FadeOne) : t;
+}
+
+/**
+ *  Interpolates the 8-bit SKBV value between levels and paces the writes.
+ *  Free of IOKit dependencies, the caller supplies time in milliseconds
+ *  and performs the writes.
+ */
+class BacklightFader {
+public:
+    FadeCurve curve {FadeCurve::Smoothstep};
+
+    /**
+     *  Length of one fade, 0 jumps straight to the target
+     */
+    uint32_t durationMS {250};
+
+    /**
+     *  Delay between two interpolation frames
+     */
+    uint32_t frameIntervalMS {33};
+
+    /**
+     *  Cap on device writes, 0 for no cap
+     */
+    uint32_t maxWritesPerSecond {30};
+
+    struct Step {
+        /**
+         *  value has to be written to the device
+         */
+        bool write;
+        uint8_t value;
+
+        /**
+         *  Delay until the next step, 0 when the fade is complete
+         */
+        uint32_t nextMS;
+    };
+
+    /**
+     *  Start fading to target from wherever the current fade is,
+     *  so a new target arriving mid-fade does not jump.
+     */
+    void setTarget(uint8_t target, uint64_t nowMS) {
+        from = written ? valueAt(nowMS) : target;
+        to = target;
+        startMS = nowMS;
+    }
+
+    /**
+     *  Value was written to the device outside of the fader
+     */
+    void jumpTo(uint8_t value, uint64_t nowMS) {
+        from = to = lastValue = value;
+        startMS = lastWriteMS = nowMS;
+        written = true;
+    }
+
+    /**
+     *  Advance the fade, the caller writes the value if asked to and reschedules after nextMS
+     */
+    Step step(uint64_t nowMS) {
+        uint8_t value = valueAt(nowMS);
+        bool finished = nowMS - startMS >= durationMS;
+        uint32_t spacing = maxWritesPerSecond ? 1000 / maxWritesPerSecond : 0;
+        uint32_t frame = frameIntervalMS > spacing ? frameIntervalMS : spacing;
+        if (frame == 0)
+            frame = 1;
+
+        if (written && value == lastValue)
+            return {false, value, finished ? 0 : frame};
+
+        uint64_t sinceWrite = nowMS - lastWriteMS;
+        if (written && sinceWrite < spacing)
+            return {false, value, static_cast<uint32_t>(spacing - sinceWrite)};
+
+        lastValue = value;
+        lastWriteMS = nowMS;
+        written = true;
+        writes++;
+        return {true, value, finished ? 0 : frame};
+    }
+
+    uint8_t target() const { return to; }
+    uint32_t writeCount() const { return writes; }
+
+private:
+    uint8_t from {0};
+    uint8_t to {0};
+    uint8_t lastValue {0};
+    bool written {false};
+    uint64_t startMS {0};
+    uint64_t lastWriteMS {0};
+    uint32_t writes {0};
+
+    uint8_t valueAt(uint64_t nowMS) const {
+        uint64_t elapsed = nowMS - startMS;
+        if (elapsed >= durationMS)
+            return to;
+        uint32_t t = applyFadeCurve(curve, static_cast<uint32_t>(elapsed * FadeOne / durationMS));
+        int32_t delta = static_cast<int32_t>(to) - from;
+        return static_cast<uint8_t>(from + delta * static_cast<int32_t>(t) / static_cast<int32_t>(FadeOne));
+    }
+};
+
+#endif /* BacklightFade_hpp */
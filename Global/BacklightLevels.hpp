@@ -0,0 +1,68 @@
+//
+//  BacklightLevels.hpp
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef BacklightLevels_hpp
+#define BacklightLevels_hpp
+
+#include <stdint.h>
+
+/**
+ *  Keyboard backlight levels as seen by the Fn keys (0...16)
+ */
+static constexpr uint16_t KBLMaxLevel = 16;
+
+/**
+ *  Panel brightness steps used by the brightness keys
+ */
+static constexpr uint32_t PanelBrightnessSteps = 16;
+
+/**
+ *  Convert Fn key backlight level to the 8-bit SKBV argument
+ */
+inline uint16_t kblLevelToSKBV(uint16_t level) {
+    uint32_t val = level * 16U;
+    return val > 255 ? 255 : static_cast<uint16_t>(val);
+}
+
+/**
+ *  Decode LKSB SMC key (12-bit brightness spread over two bytes) to the 8-bit SKBV argument
+ */
+inline uint16_t lkbToSKBV(uint8_t val1, uint8_t val2) {
+    uint16_t tval = (val1 << 4) | (val2 >> 4);
+    return tval / 16;
+}
+
+/**
+ *  Convert 8-bit SKBV argument to USB HID keyboard backlight level (0...3)
+ */
+inline uint8_t skbvToHIDLevel(uint8_t val) {
+    return val / 64;
+}
+
+/**
+ *  Highest panel level an ATK brightness notification can carry (0...15),
+ *  firmwares with fewer levels top out earlier
+ */
+static constexpr uint32_t PanelATKMaxLevel = 15;
+
+/**
+ *  Convert ATK panel level (0...maxLevel) to IODisplayParameters brightness value within min...max
+ */
+inline uint32_t atkLevelToPanelBrightness(uint8_t level, uint32_t maxLevel, uint32_t min, uint32_t max) {
+    if (level >= maxLevel || max <= min)
+        return max;
+    return min + static_cast<uint32_t>(static_cast<uint64_t>(max - min) * level / maxLevel);
+}
+
+/**
+ *  Convert IODisplayParameters brightness value to brightness key steps
+ */
+inline uint32_t panelBrightnessToSteps(uint32_t value) {
+    return value / 64;
+}
+
+#endif /* BacklightLevels_hpp */
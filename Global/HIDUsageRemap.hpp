@@ -0,0 +1,179 @@
+//
+//  HIDUsageRemap.hpp
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef HIDUsageRemap_hpp
+#define HIDUsageRemap_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "HIDUsageTables.h"
+
+/**
+ *  What AsusHIDDriver does with a vendor usage
+ */
+enum class HIDRemapKind : uint8_t {
+    Pass,       // hand to IOHIDEventDriver unchanged
+    Drop,       // swallow
+    Remap,      // hand to IOHIDEventDriver as targetPage/targetUsage
+    Message,    // send message to AsusSMC on key down
+};
+
+/**
+ *  Messages AsusHIDDriver can send to AsusSMC, indexed into HIDRemapMessageNames
+ */
+enum class HIDRemapMessage : uint8_t {
+    Sleep,
+    AirplaneMode,
+    TouchpadToggle,
+    DisplayOff,
+    MessageCount
+};
+
+static constexpr const char *HIDRemapMessageNames[] = {
+    "Sleep",
+    "AirplaneMode",
+    "TouchpadToggle",
+    "DisplayOff",
+};
+
+static_assert(sizeof(HIDRemapMessageNames) / sizeof(HIDRemapMessageNames[0]) == static_cast<size_t>(HIDRemapMessage::MessageCount), "HIDRemapMessageNames is out of sync with HIDRemapMessage");
+
+inline bool hidRemapMessageFromName(const char *name, HIDRemapMessage &message) {
+    for (uint8_t i = 0; i < static_cast<uint8_t>(HIDRemapMessage::MessageCount); i++) {
+        if (!strcmp(name, HIDRemapMessageNames[i])) {
+            message = static_cast<HIDRemapMessage>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+struct HIDRemapEntry {
+    /**
+     *  Element is tracked in customKeyboardElements
+     */
+    bool accept {false};
+
+    HIDRemapKind kind {HIDRemapKind::Pass};
+    HIDRemapMessage message {HIDRemapMessage::Sleep};
+    uint16_t targetPage {0};
+    uint16_t targetUsage {0};
+};
+
+/**
+ *  Vendor pages covered by the remap table, all their usages are 8-bit
+ */
+static constexpr uint32_t HIDRemapPageCount = 2;
+static constexpr uint32_t HIDRemapUsageCount = 256;
+
+constexpr int hidRemapPageIndex(uint32_t usagePage) {
+    return usagePage == kHIDPage_AsusVendor ? 0 : usagePage == kHIDPage_MicrosoftVendor ? 1 : -1;
+}
+
+constexpr HIDRemapEntry makeRemap(uint16_t page, uint16_t usage) {
+    return {true, HIDRemapKind::Remap, HIDRemapMessage::Sleep, page, usage};
+}
+
+constexpr HIDRemapEntry makeMessage(HIDRemapMessage message) {
+    return {true, HIDRemapKind::Message, message, 0, 0};
+}
+
+constexpr HIDRemapEntry defaultHIDRemap(uint32_t usagePage, uint32_t usage) {
+    if (usagePage == kHIDPage_AsusVendor) {
+        switch (usage) {
+            case kHIDUsage_AsusVendor_BrightnessDown:
+                return makeRemap(kHIDPage_AppleVendorTopCase, kHIDUsage_AV_TopCase_BrightnessDown);
+            case kHIDUsage_AsusVendor_BrightnessUp:
+                return makeRemap(kHIDPage_AppleVendorTopCase, kHIDUsage_AV_TopCase_BrightnessUp);
+            case kHIDUsage_AsusVendor_IlluminationUp:
+                return makeRemap(kHIDPage_AppleVendorTopCase, kHIDUsage_AV_TopCase_IlluminationUp);
+            case kHIDUsage_AsusVendor_IlluminationDown:
+                return makeRemap(kHIDPage_AppleVendorTopCase, kHIDUsage_AV_TopCase_IlluminationDown);
+            case kHIDUsage_AsusVendor_Sleep:
+                return makeMessage(HIDRemapMessage::Sleep);
+            case kHIDUsage_AsusVendor_TouchpadToggle:
+                return makeMessage(HIDRemapMessage::TouchpadToggle);
+            case kHIDUsage_AsusVendor_DisplayOff:
+                return makeMessage(HIDRemapMessage::DisplayOff);
+            case kHIDUsage_AsusVendor_ROG:
+            case kHIDUsage_AsusVendor_Power4Gear:
+            case kHIDUsage_AsusVendor_MicMute:
+            case kHIDUsage_AsusVendor_Camera:
+            case kHIDUsage_AsusVendor_RFKill:
+            case kHIDUsage_AsusVendor_Fan:
+            case kHIDUsage_AsusVendor_Calc:
+            case kHIDUsage_AsusVendor_Splendid:
+                return {true, HIDRemapKind::Drop, HIDRemapMessage::Sleep, 0, 0};
+            default:
+                return {false, HIDRemapKind::Drop, HIDRemapMessage::Sleep, 0, 0};
+        }
+    }
+
+    if (usagePage == kHIDPage_MicrosoftVendor) {
+        switch (usage) {
+            case kHIDUsage_MicrosoftVendor_WLAN:
+                return makeMessage(HIDRemapMessage::AirplaneMode);
+            case kHIDUsage_MicrosoftVendor_BrightnessDown:
+                return makeRemap(kHIDPage_AppleVendorTopCase, kHIDUsage_AV_TopCase_BrightnessDown);
+            case kHIDUsage_MicrosoftVendor_BrightnessUp:
+                return makeRemap(kHIDPage_AppleVendorTopCase, kHIDUsage_AV_TopCase_BrightnessUp);
+            case kHIDUsage_MicrosoftVendor_DisplayOff:
+                return makeMessage(HIDRemapMessage::DisplayOff);
+            case kHIDUsage_MicrosoftVendor_Camera:
+            case kHIDUsage_MicrosoftVendor_ROG:
+                return {true, HIDRemapKind::Pass, HIDRemapMessage::Sleep, 0, 0};
+            default:
+                break;
+        }
+    }
+
+    return {};
+}
+
+struct HIDRemapTable {
+    HIDRemapEntry entries[HIDRemapPageCount][HIDRemapUsageCount];
+
+    /**
+     *  Usages past the table keep the page default, unknown Asus usages are dropped
+     */
+    HIDRemapEntry outOfRange[HIDRemapPageCount];
+
+    /**
+     *  Entry for usage, nullptr when page is not covered by the table
+     */
+    const HIDRemapEntry *lookup(uint32_t usagePage, uint32_t usage) const {
+        int page = hidRemapPageIndex(usagePage);
+        if (page < 0)
+            return nullptr;
+        if (usage >= HIDRemapUsageCount)
+            return &outOfRange[page];
+        return &entries[page][usage];
+    }
+};
+
+constexpr HIDRemapTable makeHIDRemapTable() {
+    HIDRemapTable table {};
+    for (uint32_t usage = 0; usage < HIDRemapUsageCount; usage++) {
+        table.entries[0][usage] = defaultHIDRemap(kHIDPage_AsusVendor, usage);
+        table.entries[1][usage] = defaultHIDRemap(kHIDPage_MicrosoftVendor, usage);
+    }
+    table.outOfRange[0] = defaultHIDRemap(kHIDPage_AsusVendor, HIDRemapUsageCount);
+    table.outOfRange[1] = defaultHIDRemap(kHIDPage_MicrosoftVendor, HIDRemapUsageCount);
+    return table;
+}
+
+/**
+ *  Default vendor usage handling, built at compile time from HIDUsageTables.h.
+ *  Each AsusHIDDriver patches a copy of it from the UsageRemap personality property.
+ */
+static constexpr HIDRemapTable DefaultHIDRemapTable = makeHIDRemapTable();
+
+static_assert(DefaultHIDRemapTable.entries[0][kHIDUsage_AsusVendor_Sleep].kind == HIDRemapKind::Message, "HID remap table is not built at compile time");
+static_assert(DefaultHIDRemapTable.outOfRange[0].kind == HIDRemapKind::Drop, "Asus vendor usages past the table must be dropped");
+
+#endif /* HIDUsageRemap_hpp */
@@ -0,0 +1,46 @@
+//
+//  KeyPressFilter.hpp
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef KeyPressFilter_hpp
+#define KeyPressFilter_hpp
+
+#include <IOKit/hid/IOHIDUsageTables.h>
+#include <VirtualSMCSDK/kern_vsmcapi.hpp>
+
+/**
+ *  Key press timestamps are forwarded to touchpad drivers at most once per interval
+ */
+static constexpr uint32_t KeyPressNotifyIntervalMS = 50;
+
+/**
+ *  Touchpad drivers only care about non-modifier key downs
+ */
+constexpr bool isTypingKeyPress(uint32_t usagePage, uint32_t usage, uint32_t value) {
+    return value && usagePage == kHIDPage_KeyboardOrKeypad &&
+        (usage < kHIDUsage_KeyboardLeftControl || usage > kHIDUsage_KeyboardRightGUI);
+}
+
+/**
+ *  Lets through one key press per KeyPressNotifyIntervalMS, the rest of a key storm is dropped.
+ *  Consumers only need a recent timestamp, so racing callers may both pass.
+ */
+class KeyPressLimiter {
+public:
+    bool admit(uint64_t timestampNS) {
+        uint64_t last = atomic_load_explicit(&lastNS, memory_order_relaxed);
+        if (timestampNS >= last && timestampNS - last < KeyPressNotifyIntervalMS * 1000000ULL)
+            return false;
+
+        atomic_store_explicit(&lastNS, timestampNS, memory_order_relaxed);
+        return true;
+    }
+
+private:
+    _Atomic(uint64_t) lastNS = ATOMIC_VAR_INIT(0);
+};
+
+#endif /* KeyPressFilter_hpp */
@@ -0,0 +1,97 @@
+//
+//  StatPublisher.hpp
+//  AsusSMC
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef StatPublisher_hpp
+#define StatPublisher_hpp
+
+#include <IOKit/IOTimerEventSource.h>
+#include <IOKit/IOWorkLoop.h>
+#include <VirtualSMCSDK/kern_vsmcapi.hpp>
+
+/**
+ *  Named counter of a statistics dictionary
+ */
+struct StatCounter {
+    const char *name;
+    uint32_t value;
+};
+
+template <size_t N>
+inline OSDictionary *makeCounters(const StatCounter (&counters)[N]) {
+    OSDictionary *stats = OSDictionary::withCapacity(N + 1);
+    if (!stats)
+        return nullptr;
+
+    for (auto &counter : counters) {
+        if (OSNumber *value = OSNumber::withNumber(counter.value, 32)) {
+            stats->setObject(counter.name, value);
+            value->release();
+        }
+    }
+    return stats;
+}
+
+template <size_t N>
+inline void publishCounters(IORegistryEntry *entry, const char *key, const StatCounter (&counters)[N]) {
+    if (OSDictionary *stats = makeCounters(counters)) {
+        entry->setProperty(key, stats);
+        stats->release();
+    }
+}
+
+/**
+ *  Publishes statistics properties from a workloop timer, like other
+ *  properties they are set when things change and not in serializeProperties.
+ *  Events only call schedule, the first one after a publish arms the timer,
+ *  so hot paths never allocate.
+ */
+class StatPublisher {
+public:
+    static constexpr uint32_t IntervalMS {1000};
+
+    /**
+     *  Add the timer to workloop, action has to call published before publishing
+     */
+    bool init(OSObject *owner, IOWorkLoop *workloop, IOTimerEventSource::Action action) {
+        timer = IOTimerEventSource::timerEventSource(owner, action);
+        if (!timer || workloop->addEventSource(timer) != kIOReturnSuccess) {
+            OSSafeReleaseNULL(timer);
+            return false;
+        }
+        return true;
+    }
+
+    void deinit(IOWorkLoop *workloop) {
+        if (!timer)
+            return;
+
+        timer->cancelTimeout();
+        workloop->removeEventSource(timer);
+        OSSafeReleaseNULL(timer);
+    }
+
+    /**
+     *  Counters changed, publish them within IntervalMS
+     */
+    void schedule() {
+        if (timer && !atomic_exchange_explicit(&armed, true, memory_order_relaxed))
+            timer->setTimeoutMS(IntervalMS);
+    }
+
+    /**
+     *  Timer fired, later changes arm it again
+     */
+    void published() {
+        atomic_store_explicit(&armed, false, memory_order_relaxed);
+    }
+
+private:
+    IOTimerEventSource *timer {nullptr};
+    _Atomic(bool) armed = ATOMIC_VAR_INIT(false);
+};
+
+#endif /* StatPublisher_hpp */
@@ -8,6 +8,30 @@
 #include "KernEventServer.hpp"
 #include <VirtualSMCSDK/kern_vsmcapi.hpp>
 
+bool KernEventServer::init() {
+    lock = IOLockAlloc();
+    flushCall = thread_call_allocate(flushCallback, this);
+    if (!lock || !flushCall) {
+        DBGLOG("kevserver", "init error, batching disabled");
+        deinit();
+        return false;
+    }
+    return true;
+}
+
+void KernEventServer::deinit() {
+    if (flushCall) {
+        thread_call_cancel_wait(flushCall);
+        thread_call_free(flushCall);
+        flushCall = nullptr;
+    }
+    if (lock) {
+        flush();
+        IOLockFree(lock);
+        lock = nullptr;
+    }
+}
+
 bool KernEventServer::setVendorID(const char *vendorCode) {
     if (KERN_SUCCESS != kev_vendor_code_find(vendorCode, &vendorID)) {
         DBGLOG("kevserver", "setVendorID error");
@@ -21,6 +45,54 @@ void KernEventServer::setEventCode(u_int32_t code) {
 }
 
 bool KernEventServer::sendMessage(int type, int x, int y) {
+    uint64_t now;
+    absolutetime_to_nanoseconds(mach_absolute_time(), &now);
+
+    if (!lock) {
+        AsusSMCEventHeader header {AsusSMCEventVersion, 1, 0};
+        AsusSMCEventRecord record {nextSeq++, static_cast<uint32_t>(type), now, x, y};
+        return post(header, &record);
+    }
+
+    IOLockLock(lock);
+    records[recordCount++] = {nextSeq++, static_cast<uint32_t>(type), now, x, y};
+    // The first record opens the window, later ones ride along
+    bool first = recordCount == 1;
+    // Batch is full, do not wait for the thread call
+    bool full = recordCount == AsusSMCEventMaxRecords;
+    if (full)
+        postBatch();
+    IOLockUnlock(lock);
+
+    if (first && !full) {
+        uint64_t deadline;
+        clock_interval_to_deadline(BatchWindowUS, kMicrosecondScale, &deadline);
+        thread_call_enter_delayed(flushCall, deadline);
+    }
+    return true;
+}
+
+void KernEventServer::flush() {
+    IOLockLock(lock);
+    postBatch();
+    IOLockUnlock(lock);
+}
+
+void KernEventServer::flushCallback(thread_call_param_t param0, thread_call_param_t param1) {
+    static_cast<KernEventServer *>(param0)->flush();
+}
+
+void KernEventServer::postBatch() {
+    if (!recordCount)
+        return;
+
+    AsusSMCEventHeader header {AsusSMCEventVersion, recordCount, dropped};
+    if (!post(header, records))
+        dropped += recordCount;
+    recordCount = 0;
+}
+
+bool KernEventServer::post(AsusSMCEventHeader &header, AsusSMCEventRecord *batch) {
     // kernel event message
     struct kev_msg kEventMsg = {0};
 
@@ -31,25 +103,21 @@ bool KernEventServer::sendMessage(int type, int x, int y) {
     kEventMsg.vendor_code = vendorID;
 
     // set class
-    kEventMsg.kev_class = KEV_ANY_CLASS;
+    kEventMsg.kev_class = AsusSMCEventClass;
 
     // set subclass
-    kEventMsg.kev_subclass = KEV_ANY_SUBCLASS;
+    kEventMsg.kev_subclass = AsusSMCEventSubclass;
 
     // set event code
     kEventMsg.event_code = eventCode;
 
-    // type
-    kEventMsg.dv[0].data_length = sizeof(int);
-    kEventMsg.dv[0].data_ptr = &type;
-
-    // x
-    kEventMsg.dv[1].data_length = sizeof(int);
-    kEventMsg.dv[1].data_ptr = &x;
+    // header
+    kEventMsg.dv[0].data_length = sizeof(header);
+    kEventMsg.dv[0].data_ptr = &header;
 
-    // y
-    kEventMsg.dv[2].data_length = sizeof(int);
-    kEventMsg.dv[2].data_ptr = &y;
+    // records
+    kEventMsg.dv[1].data_length = header.count * sizeof(AsusSMCEventRecord);
+    kEventMsg.dv[1].data_ptr = batch;
 
     if (KERN_SUCCESS != kev_msg_post(&kEventMsg)) {
         DBGLOG("kevserver", "sendMessage error\n");
@@ -10,18 +10,61 @@
 
 extern "C" {
 #include <sys/kern_event.h>
+#include <kern/thread_call.h>
 }
 #include <IOKit/IOLib.h>
+#include <IOKit/IOLocks.h>
+#include "AsusSMCEvents.h"
 
 class KernEventServer {
 public:
+    /**
+     *  Allocate batching resources, without them every message is posted synchronously
+     */
+    bool init();
+    void deinit();
+
     bool setVendorID(const char *vendorCode);
     void setEventCode(u_int32_t code);
+
+    /**
+     *  Records queued within BatchWindowUS of the first one are posted as one kernel event
+     */
+    static constexpr uint32_t BatchWindowUS {2000};
+
+    /**
+     *  Queue a record, posted at the end of the batch window or once the batch is full
+     */
     bool sendMessage(int type, int x, int y);
 
+    /**
+     *  Post all queued records now
+     */
+    void flush();
+
 private:
     const char *getName();
     u_int32_t vendorID = 0, eventCode = 0;
+
+    /**
+     *  Protects the pending batch and keeps posts in sequence order
+     */
+    IOLock *lock {nullptr};
+    thread_call_t flushCall {nullptr};
+
+    AsusSMCEventRecord records[AsusSMCEventMaxRecords] {};
+    uint16_t recordCount {0};
+    uint32_t nextSeq {0};
+    uint32_t dropped {0};
+
+    static void flushCallback(thread_call_param_t param0, thread_call_param_t param1);
+
+    /**
+     *  Post the pending batch, called with lock held
+     */
+    void postBatch();
+
+    bool post(AsusSMCEventHeader &header, AsusSMCEventRecord *batch);
 };
 
 #endif /* KernEventServer_hpp */
@@ -5,6 +5,13 @@
 //  Copyright © 2019 Le Bao Hiep. All rights reserved.
 //
 
+#ifndef HIDReport_hpp
+#define HIDReport_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
 class __attribute__((packed)) keys final {
 public:
     keys(void) : keys_{} {}
@@ -71,6 +78,72 @@ private:
     uint8_t keys_[32];
 };
 
+static_assert(sizeof(keys) == 32, "keys must match the 32-slot report array");
+
+/**
+ *  Key state kept as a 256-bit usage bitmap.
+ *  Insert, erase and exists are single bit operations, count and empty
+ *  look at four words, and the packed 32-slot array is only produced
+ *  by serialize when a report is about to be posted.
+ */
+class key_bitmap final {
+public:
+    key_bitmap(void) : bits_{} {}
+
+    bool empty(void) const {
+        return (bits_[0] | bits_[1] | bits_[2] | bits_[3]) == 0;
+    }
+
+    void clear(void) {
+        memset(bits_, 0, sizeof(bits_));
+    }
+
+    // Usage 0 marks an empty slot on the wire and cannot be pressed
+    void insert(uint8_t key) {
+        if (key != 0) {
+            bits_[key >> 6] |= bit(key);
+        }
+    }
+
+    void erase(uint8_t key) {
+        bits_[key >> 6] &= ~bit(key);
+    }
+
+    bool exists(uint8_t key) const {
+        return key != 0 && (bits_[key >> 6] & bit(key)) != 0;
+    }
+
+    size_t count(void) const {
+        return __builtin_popcountll(bits_[0]) + __builtin_popcountll(bits_[1]) +
+               __builtin_popcountll(bits_[2]) + __builtin_popcountll(bits_[3]);
+    }
+
+    // Pack pressed usages in ascending order into the report array, extra keys beyond 32 are dropped.
+    // keys kept insertion order instead. Both are the same for the single key reports AsusSMC
+    // posts, and the order of an HID array field carries no meaning for its consumers.
+    void serialize(keys &out) const {
+        uint8_t raw[32] = {};
+        size_t slot = 0;
+        for (size_t word = 0; word < 4 && slot < sizeof(raw); word++) {
+            uint64_t w = bits_[word];
+            while (w && slot < sizeof(raw)) {
+                raw[slot++] = static_cast<uint8_t>(word * 64 + __builtin_ctzll(w));
+                w &= w - 1;
+            }
+        }
+        static_assert(sizeof(raw) == sizeof(keys), "keys layout changed");
+        memcpy(&out, raw, sizeof(raw));
+    }
+
+    bool operator==(const key_bitmap& other) const { return (memcmp(bits_, other.bits_, sizeof(bits_)) == 0); }
+    bool operator!=(const key_bitmap& other) const { return !(*this == other); }
+
+private:
+    static uint64_t bit(uint8_t key) { return 1ULL << (key & 63); }
+
+    uint64_t bits_[4];
+};
+
 class __attribute__((packed)) consumer_input final {
 public:
     consumer_input(void) : report_id_(1) {}
@@ -81,7 +154,7 @@ private:
     uint8_t report_id_ __attribute__((unused));
 
 public:
-    keys keys;
+    ::keys keys;
 };
 
 class __attribute__((packed)) apple_vendor_top_case_input final {
@@ -94,5 +167,10 @@ private:
     uint8_t report_id_ __attribute__((unused));
 
 public:
-    keys keys;
+    ::keys keys;
 };
+
+static_assert(sizeof(consumer_input) == 33, "consumer_input must match report id 1 in the report descriptor");
+static_assert(sizeof(apple_vendor_top_case_input) == 33, "apple_vendor_top_case_input must match report id 2 in the report descriptor");
+
+#endif /* HIDReport_hpp */
@@ -50,9 +50,133 @@ bool VirtualHIDKeyboard::handleStart(IOService *provider) {
     setProperty("HIDDefaultBehavior", kOSBooleanTrue);
     setProperty("AppleVendorSupported", kOSBooleanTrue);
 
+    for (auto &buffer : reportRing) {
+        buffer = IOBufferMemoryDescriptor::withCapacity(MaxReportSize, kIODirectionNone);
+        if (!buffer) {
+            SYSLOG("virtkbrd", "Failed to allocate report buffer");
+            return false;
+        }
+    }
+
+    if (!statPublisher.init(this, getWorkLoop(), [](OSObject *object, IOTimerEventSource *sender) {
+        auto keyboard = OSDynamicCast(VirtualHIDKeyboard, object);
+        if (keyboard) keyboard->publishStatistics();
+    }))
+        SYSLOG("virtkbrd", "Failed to add statistics timer");
+    statPublisher.schedule();
+
     return true;
 }
 
+void VirtualHIDKeyboard::free() {
+    for (auto &buffer : reportRing)
+        OSSafeReleaseNULL(buffer);
+    super::free();
+}
+
+void VirtualHIDKeyboard::handleStop(IOService *provider) {
+    statPublisher.deinit(getWorkLoop());
+    super::handleStop(provider);
+}
+
+void VirtualHIDKeyboard::publishStatistics() {
+    statPublisher.published();
+
+    const StatCounter counters[] = {
+        {"ReportsPosted", atomic_load_explicit(&reportsPosted, memory_order_relaxed)},
+        {"ReportRingExhausted", atomic_load_explicit(&reportRingExhausted, memory_order_relaxed)},
+    };
+    publishCounters(this, "ReportRingStatistics", counters);
+}
+
+int VirtualHIDKeyboard::acquireReportBuffer() {
+    uint32_t start = atomic_fetch_add_explicit(&reportRingNext, 1, memory_order_relaxed);
+    for (uint32_t i = 0; i < ReportRingSize; i++) {
+        uint32_t index = (start + i) % ReportRingSize;
+        uint32_t bit = 1U << index;
+        uint32_t busy = atomic_fetch_or_explicit(&reportRingBusy, bit, memory_order_acquire);
+        if (!(busy & bit))
+            return static_cast<int>(index);
+    }
+    return -1;
+}
+
+void VirtualHIDKeyboard::releaseReportBuffer(int index) {
+    atomic_fetch_and_explicit(&reportRingBusy, ~(1U << index), memory_order_release);
+}
+
+IOReturn VirtualHIDKeyboard::postReport(const void *report, uint32_t reportSize) {
+    if (!report || reportSize == 0) {
+        return kIOReturnBadArgument;
+    }
+
+    atomic_fetch_add_explicit(&reportsPosted, 1, memory_order_relaxed);
+    statPublisher.schedule();
+
+    int index = reportSize <= MaxReportSize ? acquireReportBuffer() : -1;
+    if (index < 0) {
+        // Ring exhausted (or report too large), take the slow path
+        atomic_fetch_add_explicit(&reportRingExhausted, 1, memory_order_relaxed);
+        IOReturn result = kIOReturnNoMemory;
+        if (auto buffer = IOBufferMemoryDescriptor::withBytes(report, reportSize, kIODirectionNone)) {
+            result = handleReport(buffer, kIOHIDReportTypeInput, kIOHIDOptionsTypeNone);
+            buffer->release();
+        }
+        return result;
+    }
+
+    IOBufferMemoryDescriptor *buffer = reportRing[index];
+    lilu_os_memcpy(buffer->getBytesNoCopy(), report, reportSize);
+    buffer->setLength(reportSize);
+    IOReturn result = handleReport(buffer, kIOHIDReportTypeInput, kIOHIDOptionsTypeNone);
+    releaseReportBuffer(index);
+    return result;
+}
+
+IOReturn VirtualHIDKeyboard::postKeyRepeat(const void *pressReport, const void *releaseReport, uint32_t reportSize, uint32_t count) {
+    if (!pressReport || !releaseReport || reportSize == 0) {
+        return kIOReturnBadArgument;
+    }
+
+    int pressIndex = reportSize <= MaxReportSize ? acquireReportBuffer() : -1;
+    int releaseIndex = pressIndex >= 0 ? acquireReportBuffer() : -1;
+    if (releaseIndex < 0) {
+        if (pressIndex >= 0)
+            releaseReportBuffer(pressIndex);
+
+        IOReturn result = kIOReturnSuccess;
+        while (count--) {
+            IOReturn ret = postReport(pressReport, reportSize);
+            if (result == kIOReturnSuccess) result = ret;
+            ret = postReport(releaseReport, reportSize);
+            if (result == kIOReturnSuccess) result = ret;
+        }
+        return result;
+    }
+
+    IOBufferMemoryDescriptor *press = reportRing[pressIndex];
+    IOBufferMemoryDescriptor *release = reportRing[releaseIndex];
+    lilu_os_memcpy(press->getBytesNoCopy(), pressReport, reportSize);
+    lilu_os_memcpy(release->getBytesNoCopy(), releaseReport, reportSize);
+    press->setLength(reportSize);
+    release->setLength(reportSize);
+
+    atomic_fetch_add_explicit(&reportsPosted, count * 2, memory_order_relaxed);
+    statPublisher.schedule();
+
+    IOReturn result = kIOReturnSuccess;
+    while (count--) {
+        IOReturn ret = handleReport(press, kIOHIDReportTypeInput, kIOHIDOptionsTypeNone);
+        if (result == kIOReturnSuccess) result = ret;
+        ret = handleReport(release, kIOHIDReportTypeInput, kIOHIDOptionsTypeNone);
+        if (result == kIOReturnSuccess) result = ret;
+    }
+
+    releaseReportBuffer(releaseIndex);
+    releaseReportBuffer(pressIndex);
+    return result;
+}
+
 OSNumber *VirtualHIDKeyboard::newCountryCodeNumber() const {
     return OSNumber::withNumber(static_cast<uint32_t>(countryCode_), 32);
 }
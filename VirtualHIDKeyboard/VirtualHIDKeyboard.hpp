@@ -5,13 +5,21 @@
 //  Copyright © 2018-2019 Le Bao Hiep. All rights reserved.
 //
 
+#ifndef VirtualHIDKeyboard_hpp
+#define VirtualHIDKeyboard_hpp
+
 #include <IOKit/hid/IOHIDDevice.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <VirtualSMCSDK/kern_vsmcapi.hpp>
+#include "StatPublisher.hpp"
 
 class VirtualHIDKeyboard final : public IOHIDDevice {
     OSDeclareDefaultStructors(VirtualHIDKeyboard);
 
 public:
     bool handleStart(IOService *provider) override;
+    void free() override;
+    void handleStop(IOService *provider) override;
 
     // ----------------------------------------
 
@@ -60,4 +68,43 @@ public:
     // ----------------------------------------
 
     static void setCountryCode(uint8_t value);
+
+    /**
+     *  Post an input report through a preallocated descriptor, falling back to allocation when the ring is exhausted
+     */
+    IOReturn postReport(const void *report, uint32_t reportSize);
+
+    /**
+     *  Post a press/release report pair count times. The report buffers are
+     *  filled only once, but every report is still a separate handleReport call.
+     */
+    IOReturn postKeyRepeat(const void *pressReport, const void *releaseReport, uint32_t reportSize, uint32_t count);
+
+private:
+    /**
+     *  Report descriptors reused across posts
+     */
+    static constexpr uint32_t ReportRingSize {8};
+    static constexpr uint32_t MaxReportSize {64};
+    IOBufferMemoryDescriptor *reportRing[ReportRingSize] {};
+
+    /**
+     *  Bit N is set while reportRing[N] is being handled
+     */
+    _Atomic(uint32_t) reportRingBusy = ATOMIC_VAR_INIT(0);
+    _Atomic(uint32_t) reportRingNext = ATOMIC_VAR_INIT(0);
+
+    /**
+     *  Statistics
+     */
+    _Atomic(uint32_t) reportsPosted = ATOMIC_VAR_INIT(0);
+    _Atomic(uint32_t) reportRingExhausted = ATOMIC_VAR_INIT(0);
+
+    StatPublisher statPublisher;
+    void publishStatistics();
+
+    int acquireReportBuffer();
+    void releaseReportBuffer(int index);
 };
+
+#endif /* VirtualHIDKeyboard_hpp */
@@ -0,0 +1,127 @@
+//
+//  ALSTraceReplayTest.cpp
+//  AsusSMC host tests
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#include <vector>
+#include "ALSSampler.hpp"
+#include "TestSupport.hpp"
+
+/**
+ *  Replays a recorded ALSS trace through ALSSampler, sampling the trace at
+ *  the times the sampler asks for, like alsTimer does.
+ */
+
+struct Reading {
+    uint64_t ms;
+    uint32_t lux;
+};
+
+struct Sample {
+    uint64_t ms;
+    uint32_t interval;
+    bool posted;
+    uint32_t filtered;
+};
+
+static std::vector<Reading> loadTrace(const char *name) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", ASUSSMC_TRACE_DIR, name);
+    FILE *file = fopen(path, "r");
+    CHECK(file != nullptr);
+
+    std::vector<Reading> trace;
+    char line[128];
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long long ms;
+        unsigned lux;
+        if (line[0] != '#' && sscanf(line, "%llu %u", &ms, &lux) == 2)
+            trace.push_back({ms, lux});
+    }
+    fclose(file);
+    CHECK(!trace.empty());
+    return trace;
+}
+
+static uint32_t luxAt(const std::vector<Reading> &trace, uint64_t ms) {
+    uint32_t lux = trace[0].lux;
+    for (const auto &reading : trace) {
+        if (reading.ms > ms)
+            break;
+        lux = reading.lux;
+    }
+    return lux;
+}
+
+static std::vector<Sample> replay(ALSSampler &sampler, const std::vector<Reading> &trace) {
+    std::vector<Sample> samples;
+    uint64_t end = trace.back().ms;
+    for (uint64_t now = 0; now <= end; now += sampler.nextIntervalMS(ALSSampler::StableIntervalMS)) {
+        bool posted = sampler.addSample(luxAt(trace, now), now);
+        samples.push_back({now, sampler.intervalMS(), posted, sampler.lux()});
+    }
+    return samples;
+}
+
+static uint32_t samplesBetween(const std::vector<Sample> &samples, uint64_t from, uint64_t to) {
+    uint32_t count = 0;
+    for (const auto &sample : samples)
+        count += sample.ms >= from && sample.ms < to;
+    return count;
+}
+
+static const Sample &firstSampleAfter(const std::vector<Sample> &samples, uint64_t ms) {
+    for (const auto &sample : samples)
+        if (sample.ms >= ms)
+            return sample;
+    CHECK(false);
+    return samples.back();
+}
+
+int main() {
+    auto trace = loadTrace("als_office.trace");
+
+    ALSSampler sampler;
+    auto samples = replay(sampler, trace);
+
+    // Steady segments back off despite sensor noise. At the fast interval
+    // each 40 s segment would take 160 samples.
+    uint32_t office = samplesBetween(samples, 15000, 55000);
+    uint32_t dark = samplesBetween(samples, 75000, 115000);
+    uint32_t daylight = samplesBetween(samples, 135000, 175000);
+    printf("samples in 40 s: office %u, dark %u, daylight %u\n", office, dark, daylight);
+    CHECK(office <= 20);
+    CHECK(dark <= 20);
+    CHECK(daylight <= 20);
+
+    // Lights off is noticed on the next sample and sampling speeds up
+    const Sample &afterOff = firstSampleAfter(samples, 61000);
+    CHECK(afterOff.ms <= 61000 + ALSSampler::StableIntervalMS);
+    CHECK(afterOff.interval == ALSSampler::FastIntervalMS);
+
+    // Filtered lux settles on the new level within a few seconds, and the change is posted
+    const Sample &settledDark = firstSampleAfter(samples, afterOff.ms + 3000);
+    CHECK(settledDark.filtered >= 12 && settledDark.filtered <= 18);
+    bool postedDark = false;
+    for (const auto &sample : samples)
+        postedDark |= sample.ms >= 60000 && sample.ms < 70000 && sample.posted;
+    CHECK(postedDark);
+
+    const Sample &settledDaylight = firstSampleAfter(samples, 121500 + ALSSampler::StableIntervalMS + 3000);
+    CHECK(settledDaylight.filtered >= 850 && settledDaylight.filtered <= 950);
+
+    // Hysteresis still governs posting, noise in daylight is not posted
+    ALSSampler damped;
+    damped.hysteresis = 50;
+    auto dampedSamples = replay(damped, trace);
+    uint32_t dampedPosts = 0;
+    for (const auto &sample : dampedSamples)
+        dampedPosts += sample.ms >= 135000 && sample.posted;
+    CHECK_EQ(dampedPosts, 0);
+
+    printf("samples %u, interrupts %u, suppressed %u\n",
+           sampler.sampleCount(), sampler.interruptCount(), sampler.suppressedCount());
+    return 0;
+}
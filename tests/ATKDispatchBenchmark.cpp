@@ -0,0 +1,132 @@
+//
+//  ATKDispatchBenchmark.cpp
+//  AsusSMC host tests
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#include "ATKEvents.hpp"
+#include "TestSupport.hpp"
+
+#include <chrono>
+
+/**
+ *  Checks the compile-time ATK event table against decodeATKEvent for all
+ *  256 notify codes, then times each code on its own for both. The switch
+ *  cost depends on the code, so the min/max spread over mapped and unmapped
+ *  codes matters more than one mean.
+ */
+
+static void checkTable() {
+    uint32_t brightness = 0;
+    for (uint32_t code = 0; code < ATKEventCount; code++) {
+        ATKEvent decoded = decodeATKEvent(code);
+        const ATKEvent &event = DefaultATKEventTable.events[code];
+        CHECK(event.action == decoded.action);
+        CHECK_EQ(event.repeat, decoded.repeat);
+        CHECK_EQ(event.usage, decoded.usage);
+        CHECK_EQ(event.level, decoded.level);
+
+        // Only brightness codes carry a level
+        CHECK_EQ(event.action == ATKAction::PanelBrightness, isATKBrightnessCode(code));
+        if (isATKBrightnessCode(code)) {
+            CHECK_EQ(event.level, code & 0xF);
+            brightness++;
+        } else {
+            CHECK_EQ(event.level, 0);
+        }
+    }
+    CHECK_EQ(brightness, NOTIFY_BRIGHTNESS_DOWN_MAX - NOTIFY_BRIGHTNESS_UP_MIN + 1);
+}
+
+/**
+ *  Hide code from the optimizer so every lookup is done at run time
+ */
+static inline uint32_t opaque(uint32_t code) {
+    asm volatile("" : "+r"(code));
+    return code;
+}
+
+static double timeTableLookup(uint32_t code, unsigned long iterations) {
+    uint32_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++) {
+        const ATKEvent &event = DefaultATKEventTable.events[opaque(code)];
+        sum += static_cast<uint32_t>(event.action) + event.usage + event.level;
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    doNotOptimize(sum);
+    return elapsed / iterations;
+}
+
+static double timeDecode(uint32_t code, unsigned long iterations) {
+    uint32_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++) {
+        ATKEvent event = decodeATKEvent(opaque(code));
+        sum += static_cast<uint32_t>(event.action) + event.usage + event.level;
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    doNotOptimize(sum);
+    return elapsed / iterations;
+}
+
+/**
+ *  Fastest of a few runs, a single preempted run should not set the max
+ */
+template <typename F>
+static double fastestOf(F time, uint32_t code, unsigned long iterations) {
+    double best = time(code, iterations);
+    for (int run = 1; run < 3; run++) {
+        double ns = time(code, iterations);
+        if (ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+/**
+ *  Per-code cost spread over one bucket of codes
+ */
+struct Spread {
+    double min {0};
+    double max {0};
+    double total {0};
+    uint32_t minCode {0};
+    uint32_t maxCode {0};
+    uint32_t count {0};
+
+    void add(uint32_t code, double ns) {
+        if (!count || ns < min) { min = ns; minCode = code; }
+        if (!count || ns > max) { max = ns; maxCode = code; }
+        total += ns;
+        count++;
+    }
+
+    void print(const char *name) const {
+        printf("%-40s %4u codes  min %6.2f ns (0x%02x)  max %6.2f ns (0x%02x)  mean %6.2f ns\n",
+               name, count, min, minCode, max, maxCode, count ? total / count : 0.0);
+    }
+};
+
+int main() {
+    checkTable();
+
+    unsigned long iterations = benchIterations(1000000) / ATKEventCount;
+    Spread tableMapped, tableUnmapped, decodeMapped, decodeUnmapped;
+    for (uint32_t code = 0; code < ATKEventCount; code++) {
+        bool mapped = DefaultATKEventTable.events[code].action != ATKAction::None;
+        (mapped ? tableMapped : tableUnmapped).add(code, fastestOf(timeTableLookup, code, iterations));
+        (mapped ? decodeMapped : decodeUnmapped).add(code, fastestOf(timeDecode, code, iterations));
+    }
+    CHECK_EQ(tableMapped.count + tableUnmapped.count, ATKEventCount);
+
+    tableMapped.print("ATK table lookup, mapped");
+    tableUnmapped.print("ATK table lookup, unmapped");
+    decodeMapped.print("decodeATKEvent, mapped");
+    decodeUnmapped.print("decodeATKEvent, unmapped");
+    printf("worst code: decode vs table %.2fx\n",
+           (decodeMapped.max > decodeUnmapped.max ? decodeMapped.max : decodeUnmapped.max) /
+           (tableMapped.max > tableUnmapped.max ? tableMapped.max : tableUnmapped.max));
+    return 0;
+}
@@ -0,0 +1,101 @@
+//
+//  ATKEventQueueTest.cpp
+//  AsusSMC host tests
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#include <thread>
+#include <vector>
+#include "ATKEventQueue.hpp"
+#include "TestSupport.hpp"
+
+/**
+ *  Several producers push like concurrent ACPI notification callouts while
+ *  one consumer pops like the workloop. Also built with ThreadSanitizer as
+ *  ATKEventQueueTSanTest when the compiler supports it.
+ */
+
+static constexpr uint32_t Producers {4};
+static constexpr uint32_t PushesPerProducer {20000};
+
+static void checkSingleThreaded() {
+    ATKEventQueue queue;
+    queue.init();
+
+    ATKEventQueue::Entry entry;
+    CHECK(!queue.pop(entry));
+
+    for (uint32_t i = 0; i < ATKEventQueue::Capacity; i++)
+        CHECK(queue.push(i, i));
+    CHECK(!queue.push(0xFF, 0));
+    CHECK_EQ(queue.dropCount(), 1);
+    CHECK_EQ(queue.depth(), ATKEventQueue::Capacity);
+    CHECK_EQ(queue.maxDepthCount(), ATKEventQueue::Capacity);
+
+    for (uint32_t i = 0; i < ATKEventQueue::Capacity; i++) {
+        CHECK(queue.pop(entry));
+        CHECK_EQ(entry.code, i);
+    }
+    CHECK(!queue.pop(entry));
+    CHECK_EQ(queue.depth(), 0);
+}
+
+int main() {
+    checkSingleThreaded();
+
+    ATKEventQueue queue;
+    queue.init();
+
+    std::atomic<uint32_t> pushed {0};
+    std::atomic<uint32_t> running {Producers};
+    std::vector<std::thread> producers;
+    for (uint32_t p = 0; p < Producers; p++) {
+        producers.emplace_back([&queue, &pushed, &running, p] {
+            for (uint32_t i = 0; i < PushesPerProducer; i++) {
+                if (queue.push(p << 24 | i, mach_absolute_time()))
+                    pushed.fetch_add(1, std::memory_order_relaxed);
+                // Give the consumer a chance, otherwise the queue is simply full
+                if ((i & 15) == 0)
+                    std::this_thread::yield();
+            }
+            running.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    uint32_t popped = 0;
+    int64_t last[Producers];
+    for (auto &seq : last)
+        seq = -1;
+    uint64_t lastTimestamp[Producers] {};
+    ATKEventQueue::Entry entry;
+    while (true) {
+        bool done = running.load(std::memory_order_acquire) == 0;
+        while (queue.pop(entry)) {
+            uint32_t p = entry.code >> 24;
+            int64_t seq = entry.code & 0xFFFFFF;
+            CHECK(p < Producers);
+            // Per producer order is kept, drops only leave gaps
+            CHECK(seq > last[p]);
+            CHECK(entry.timestamp >= lastTimestamp[p]);
+            last[p] = seq;
+            lastTimestamp[p] = entry.timestamp;
+            popped++;
+        }
+        if (done)
+            break;
+        std::this_thread::yield();
+    }
+
+    for (auto &thread : producers)
+        thread.join();
+
+    printf("pushed %u, popped %u, dropped %u, max depth %u\n",
+           pushed.load(), popped, queue.dropCount(), queue.maxDepthCount());
+    CHECK_EQ(popped, pushed.load());
+    CHECK_EQ(pushed.load() + queue.dropCount(), Producers * PushesPerProducer);
+    CHECK(popped > ATKEventQueue::Capacity);
+    CHECK(queue.maxDepthCount() <= ATKEventQueue::Capacity);
+    CHECK_EQ(queue.depth(), 0);
+    return 0;
+}
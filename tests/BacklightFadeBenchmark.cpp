@@ -0,0 +1,152 @@
+//
+//  BacklightFadeBenchmark.cpp
+//  AsusSMC host tests
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#include <thread>
+#include <IOKit/acpi/IOACPIPlatformDevice.h>
+#include <kern/thread_call.h>
+#include "BacklightFade.hpp"
+#include "TestSupport.hpp"
+
+/**
+ *  Drives BacklightFader the way AsusSMC does: LKSB writers hand the target
+ *  over atomically and arm the fade timer, the timer (a thread call, like
+ *  IOTimerEventSource) steps the fade and evaluates SKBV on a mock ATK
+ *  device that timestamps every call.
+ */
+
+static uint64_t nowMS() {
+    return mach_absolute_time() / 1000000;
+}
+
+struct FadeHarness {
+    IOACPIPlatformDevice *atk {new IOACPIPlatformDevice};
+    OSNumber *skbvArg {OSNumber::withNumber(0ULL, 8)};
+    BacklightFader fader;
+    std::atomic<int32_t> pendingTarget {-1};
+    std::atomic<uint32_t> ecValue {0};
+    thread_call_t fadeTimer {nullptr};
+
+    FadeHarness() {
+        atk->setMethod("SKBV", [this](OSObject *params[], UInt32 count, UInt32 *result) {
+            ecValue.store(static_cast<OSNumber *>(params[0])->unsigned32BitValue(), std::memory_order_relaxed);
+            return kIOReturnSuccess;
+        });
+        fadeTimer = thread_call_allocate([](thread_call_param_t param0, thread_call_param_t param1) {
+            static_cast<FadeHarness *>(param0)->step();
+        }, this);
+    }
+
+    ~FadeHarness() {
+        thread_call_cancel_wait(fadeTimer);
+        thread_call_free(fadeTimer);
+        skbvArg->release();
+        atk->release();
+    }
+
+    void setTimeoutMS(uint32_t ms) {
+        uint64_t deadline;
+        clock_interval_to_deadline(ms, kMillisecondScale, &deadline);
+        thread_call_enter_delayed(fadeTimer, deadline);
+    }
+
+    // AsusSMC::fadeKeyboardBacklight
+    void post(uint8_t value) {
+        pendingTarget.store(value, std::memory_order_release);
+        setTimeoutMS(0);
+    }
+
+    // AsusSMC::stepKeyboardBacklightFade
+    void step() {
+        uint64_t now = nowMS();
+        int32_t target = pendingTarget.exchange(-1, std::memory_order_acquire);
+        if (target >= 0)
+            fader.setTarget(static_cast<uint8_t>(target), now);
+
+        auto next = fader.step(now);
+        if (next.write) {
+            skbvArg->setValue(next.value);
+            atk->evaluateObject("SKBV", nullptr, reinterpret_cast<OSObject **>(&skbvArg), 1);
+        }
+        if (next.nextMS)
+            setTimeoutMS(next.nextMS);
+    }
+};
+
+static void checkSpacing(const std::vector<IOACPIPlatformDevice::Call> &calls, uint32_t spacingMS) {
+    for (size_t i = 1; i < calls.size(); i++) {
+        // Fader works in whole milliseconds, allow one for truncation
+        uint64_t gapNS = calls[i].timestamp - calls[i - 1].timestamp;
+        CHECK(gapNS + 1000000 >= spacingMS * 1000000ULL);
+    }
+}
+
+static void singleFade() {
+    FadeHarness harness;
+    harness.fader.jumpTo(0, nowMS());
+
+    uint64_t posted = mach_absolute_time();
+    harness.post(255);
+    std::this_thread::sleep_for(std::chrono::milliseconds(harness.fader.durationMS + 150));
+
+    auto calls = harness.atk->calls();
+    CHECK(!calls.empty());
+    CHECK_EQ(harness.ecValue.load(), 255);
+    CHECK_EQ(calls.back().argument, 255);
+    // 250 ms at 30 writes per second
+    CHECK(calls.size() <= harness.fader.durationMS / 33 + 2);
+    checkSpacing(calls, 1000 / harness.fader.maxWritesPerSecond);
+
+    // Values only move towards the target
+    for (size_t i = 1; i < calls.size(); i++)
+        CHECK(calls[i].argument >= calls[i - 1].argument);
+
+    printf("single fade: %zu SKBV writes, first after %.1f us, last after %.1f ms\n", calls.size(),
+           (calls.front().timestamp - posted) / 1000.0, (calls.back().timestamp - posted) / 1000000.0);
+}
+
+static void burst() {
+    FadeHarness harness;
+    harness.fader.jumpTo(0, nowMS());
+
+    uint64_t start = mach_absolute_time();
+    std::thread writers[2];
+    for (uint32_t w = 0; w < 2; w++) {
+        writers[w] = std::thread([&harness, w] {
+            for (uint32_t i = 0; i < 200; i++) {
+                harness.post(static_cast<uint8_t>(i * 37 + w * 101));
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+        });
+    }
+    for (auto &writer : writers)
+        writer.join();
+    harness.post(42);
+    uint64_t lastPost = mach_absolute_time();
+    std::this_thread::sleep_for(std::chrono::milliseconds(harness.fader.durationMS + 150));
+
+    auto calls = harness.atk->calls();
+    CHECK_EQ(harness.ecValue.load(), 42);
+    uint64_t elapsedMS = (calls.back().timestamp - start) / 1000000;
+    CHECK(calls.size() <= elapsedMS / 33 + 2);
+    checkSpacing(calls, 1000 / harness.fader.maxWritesPerSecond);
+
+    printf("burst: 401 LKSB writes, %zu SKBV writes over %llu ms, settled %.1f ms after last write\n",
+           calls.size(), static_cast<unsigned long long>(elapsedMS), (calls.back().timestamp - lastPost) / 1000000.0);
+}
+
+int main() {
+    singleFade();
+    burst();
+
+    // Cost seen by the LKSB writer, it never waits for the fade
+    FadeHarness harness;
+    harness.fader.durationMS = 0;
+    benchmark("LKSB handoff (store + arm timer)", benchIterations(100000), [&harness](unsigned long i) {
+        harness.post(static_cast<uint8_t>(i));
+    });
+    return 0;
+}
@@ -0,0 +1,202 @@
+//
+//  CoreBenchmark.cpp
+//  AsusSMC host tests
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#include <IOKit/hid/IOHIDDevice.h>
+#include "ALSValue.hpp"
+#include "BacklightLevels.hpp"
+#include "HIDReport.hpp"
+#include "TestSupport.hpp"
+
+/**
+ *  Checks and times the IOKit-free hot paths: HID report building,
+ *  ALS value conversion and backlight level math.
+ */
+
+static void checkReports(IOHIDDevice *device) {
+    key_bitmap state;
+    state.insert(0x40);
+    state.insert(0x03);
+    state.insert(0xFF);
+    state.insert(0);
+    CHECK_EQ(state.count(), 3);
+    CHECK(state.exists(0xFF));
+    CHECK(!state.exists(0));
+
+    consumer_input report;
+    state.serialize(report.keys);
+    auto buffer = IOBufferMemoryDescriptor::withBytes(&report, sizeof(report), kIODirectionNone);
+    device->handleReport(buffer, kIOHIDReportTypeInput);
+    buffer->release();
+
+    auto reports = device->copyReports();
+    CHECK_EQ(reports.size(), 1);
+    CHECK_EQ(reports[0].size(), 33);
+    // Report id, then usages ascending
+    CHECK_EQ(reports[0][0], 1);
+    CHECK_EQ(reports[0][1], 0x03);
+    CHECK_EQ(reports[0][2], 0x40);
+    CHECK_EQ(reports[0][3], 0xFF);
+    CHECK_EQ(reports[0][4], 0);
+
+    state.erase(0x40);
+    state.serialize(report.keys);
+    CHECK_EQ(report.keys.count(), 2);
+    CHECK(!report.keys.exists(0x40));
+    device->clearReports();
+}
+
+/**
+ *  AsusSMC posts a press with one usage and a release with none, the bytes
+ *  have to be what the keys class put on the wire before key_bitmap
+ */
+static void checkWireCompatibility() {
+    for (uint32_t usage = 1; usage < 256; usage++) {
+        ::keys legacy;
+        key_bitmap state;
+        ::keys serialized;
+
+        legacy.insert(static_cast<uint8_t>(usage));
+        state.insert(static_cast<uint8_t>(usage));
+        state.serialize(serialized);
+        CHECK(serialized == legacy);
+
+        legacy.erase(static_cast<uint8_t>(usage));
+        state.erase(static_cast<uint8_t>(usage));
+        state.serialize(serialized);
+        CHECK(serialized == legacy);
+    }
+
+    // Several held keys keep the same set, only the slot order may differ
+    const uint8_t held[] = {0xE9, 0x04, 0xCD, 0x30};
+    ::keys legacy;
+    key_bitmap state;
+    for (uint8_t usage : held) {
+        legacy.insert(usage);
+        state.insert(usage);
+    }
+    ::keys serialized;
+    state.serialize(serialized);
+    CHECK_EQ(serialized.count(), legacy.count());
+    for (uint8_t usage : held)
+        CHECK(serialized.exists(usage));
+}
+
+static void checkALS() {
+    ALSValue value;
+    updateALSValue(&value, 300, 0);
+    CHECK(value.valid);
+    CHECK_EQ(value.chan0, alsHostToBig16(300));
+    CHECK_EQ(value.roomLux, alsHostToBig32(300 << 14));
+
+    // Forced fields stay untouched
+    updateALSValue(&value, 500, kALSForceLux);
+    CHECK_EQ(value.chan0, alsHostToBig16(500));
+    CHECK_EQ(value.roomLux, alsHostToBig32(300 << 14));
+
+    updateALSValue(&value, ALSInvalidLux, 0);
+    CHECK(!value.valid);
+
+    CHECK(alsLuxChanged(ALSInvalidLux, 10, 100));
+    CHECK(!alsLuxChanged(10, 60, 50));
+    CHECK(alsLuxChanged(10, 61, 50));
+}
+
+static void checkBacklight() {
+    CHECK_EQ(kblLevelToSKBV(0), 0);
+    CHECK_EQ(kblLevelToSKBV(8), 128);
+    CHECK_EQ(kblLevelToSKBV(KBLMaxLevel), 255);
+    CHECK_EQ(lkbToSKBV(0xFF, 0xF0), 255);
+    CHECK_EQ(lkbToSKBV(0x80, 0x00), 128);
+    CHECK_EQ(skbvToHIDLevel(255), 3);
+    CHECK_EQ(skbvToHIDLevel(63), 0);
+    CHECK_EQ(atkLevelToPanelBrightness(0, PanelATKMaxLevel, 10, 1034), 10);
+    CHECK_EQ(atkLevelToPanelBrightness(5, 10, 0, 1000), 500);
+    CHECK_EQ(atkLevelToPanelBrightness(12, 10, 0, 1000), 1000);
+    CHECK_EQ(atkLevelToPanelBrightness(15, PanelATKMaxLevel, 10, 1034), 1034);
+}
+
+int main() {
+    auto device = new IOHIDDevice;
+    checkReports(device);
+    checkWireCompatibility();
+    checkALS();
+    checkBacklight();
+
+    unsigned long iterations = benchIterations(1000000);
+
+    // dispatchCSMRReport before and after key_bitmap, state kept across presses like csmrkeys
+    consumer_input legacyReport;
+    double legacy = benchmark("keys press+release report", iterations, [&legacyReport](unsigned long i) {
+        uint8_t usage = static_cast<uint8_t>(i) | 1;
+        legacyReport.keys.insert(usage);
+        consumer_input press = legacyReport;
+        doNotOptimize(press);
+        legacyReport.keys.erase(usage);
+        doNotOptimize(legacyReport);
+    });
+    key_bitmap bitmapState;
+    consumer_input bitmapReport;
+    double bitmap = benchmark("key_bitmap press+release serialize", iterations, [&](unsigned long i) {
+        uint8_t usage = static_cast<uint8_t>(i) | 1;
+        bitmapState.insert(usage);
+        bitmapState.serialize(bitmapReport.keys);
+        consumer_input press = bitmapReport;
+        doNotOptimize(press);
+        bitmapState.erase(usage);
+        bitmapState.serialize(bitmapReport.keys);
+        doNotOptimize(bitmapReport);
+    });
+    printf("press+release: keys vs key_bitmap %.2fx\n", legacy / bitmap);
+
+    // Lookups with six keys held
+    ::keys legacyHeld;
+    key_bitmap bitmapHeld;
+    for (uint8_t usage = 0x04; usage < 0x0A; usage++) {
+        legacyHeld.insert(usage);
+        bitmapHeld.insert(usage);
+    }
+    legacy = benchmark("keys exists+count, 6 held", iterations, [&legacyHeld](unsigned long i) {
+        doNotOptimize(legacyHeld.exists(static_cast<uint8_t>(i)));
+        doNotOptimize(legacyHeld.count());
+    });
+    bitmap = benchmark("key_bitmap exists+count, 6 held", iterations, [&bitmapHeld](unsigned long i) {
+        doNotOptimize(bitmapHeld.exists(static_cast<uint8_t>(i)));
+        doNotOptimize(bitmapHeld.count());
+    });
+    printf("exists+count: keys vs key_bitmap %.2fx\n", legacy / bitmap);
+
+    benchmark("handleReport (mock device)", iterations / 10, [device](unsigned long i) {
+        consumer_input report;
+        auto buffer = IOBufferMemoryDescriptor::withBytes(&report, sizeof(report), kIODirectionNone);
+        device->handleReport(buffer, kIOHIDReportTypeInput);
+        buffer->release();
+        if ((i & 1023) == 1023)
+            device->clearReports();
+    });
+
+    benchmark("updateALSValue", iterations, [](unsigned long i) {
+        ALSValue value;
+        updateALSValue(&value, static_cast<uint32_t>(i & 0xFFFF), 0);
+        doNotOptimize(value);
+    });
+
+    benchmark("alsLuxChanged", iterations, [](unsigned long i) {
+        doNotOptimize(alsLuxChanged(static_cast<uint32_t>(i & 0xFFF), static_cast<uint32_t>((i * 7) & 0xFFF), 16));
+    });
+
+    benchmark("lkbToSKBV + skbvToHIDLevel", iterations, [](unsigned long i) {
+        uint16_t skbv = lkbToSKBV(static_cast<uint8_t>(i), static_cast<uint8_t>(i >> 8));
+        doNotOptimize(skbvToHIDLevel(static_cast<uint8_t>(skbv)));
+    });
+
+    benchmark("atkLevelToPanelBrightness", iterations, [](unsigned long i) {
+        doNotOptimize(atkLevelToPanelBrightness(static_cast<uint8_t>(i & 0xF), PanelATKMaxLevel, 0, 1024));
+    });
+
+    device->release();
+    return 0;
+}
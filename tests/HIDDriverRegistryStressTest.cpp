@@ -0,0 +1,151 @@
+//
+//  HIDDriverRegistryStressTest.cpp
+//  AsusSMC host tests
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#include <random>
+#include <thread>
+#include <vector>
+#include "HIDDriverRegistry.hpp"
+#include "TestSupport.hpp"
+
+/**
+ *  Writers add and remove drivers like kAddAsusHIDDriver/kDelAsusHIDDriver
+ *  while readers iterate like keyboard backlight updates. Once added the
+ *  registry holds the only reference, so a reader reaching a removed driver
+ *  touches freed memory. Also built with ThreadSanitizer as
+ *  HIDDriverRegistryTSanTest when the compiler supports it.
+ */
+
+static constexpr uint32_t Writers {2};
+static constexpr uint32_t Readers {4};
+static constexpr uint32_t OpsPerWriter {5000};
+
+/**
+ *  Together the writers can hold more drivers than fit, so add may also fail
+ */
+static constexpr uint32_t DriversPerWriter {HIDDriverRegistry::Capacity / Writers + 1};
+
+static void checkSingleThreaded() {
+    HIDDriverRegistry registry;
+    CHECK(registry.init());
+
+    AsusHIDDriver *drivers[HIDDriverRegistry::Capacity + 1];
+    for (auto &driver : drivers)
+        driver = new AsusHIDDriver;
+
+    for (uint32_t i = 0; i < HIDDriverRegistry::Capacity; i++)
+        CHECK(registry.add(drivers[i]));
+    CHECK(!registry.add(drivers[0]));
+    CHECK(!registry.add(drivers[HIDDriverRegistry::Capacity]));
+    CHECK_EQ(drivers[0]->getRetainCount(), 2);
+
+    uint32_t seen = 0;
+    registry.forEach([&seen](AsusHIDDriver *driver) { seen++; });
+    CHECK_EQ(seen, HIDDriverRegistry::Capacity);
+
+    CHECK(registry.remove(drivers[0]));
+    CHECK(!registry.remove(drivers[0]));
+    CHECK_EQ(drivers[0]->getRetainCount(), 1);
+
+    registry.deinit();
+    for (auto &driver : drivers)
+        driver->release();
+    CHECK_EQ(AsusHIDDriver::liveCount(), 0);
+}
+
+int main() {
+    checkSingleThreaded();
+
+    HIDDriverRegistry registry;
+    CHECK(registry.init());
+
+    std::atomic<uint32_t> running {Writers};
+    std::atomic<uint32_t> ready {0};
+    std::atomic<uint64_t> visits {0};
+    std::vector<std::thread> readers;
+    for (uint32_t r = 0; r < Readers; r++) {
+        readers.emplace_back([&, r] {
+            uint64_t seen = 0;
+            ready.fetch_add(1, std::memory_order_release);
+            while (running.load(std::memory_order_acquire)) {
+                AsusHIDDriver *snapshot[HIDDriverRegistry::Capacity];
+                uint32_t count = 0;
+                registry.forEach([&](AsusHIDDriver *driver) {
+                    CHECK(count < HIDDriverRegistry::Capacity);
+                    CHECK(driver->isAlive());
+                    driver->setKeyboardBacklight(static_cast<uint8_t>(r));
+                    for (uint32_t i = 0; i < count; i++)
+                        CHECK(snapshot[i] != driver);
+                    snapshot[count++] = driver;
+                });
+                seen += count;
+                // Leave writers some time, they wait for readers to drain
+                std::this_thread::yield();
+            }
+            visits.fetch_add(seen, std::memory_order_relaxed);
+        });
+    }
+
+    std::atomic<uint32_t> adds {0};
+    std::atomic<uint32_t> rejected {0};
+    std::atomic<uint32_t> removes {0};
+    std::vector<std::thread> writers;
+    for (uint32_t w = 0; w < Writers; w++) {
+        writers.emplace_back([&, w] {
+            std::minstd_rand random(20191017 + w);
+            std::vector<AsusHIDDriver *> owned;
+            while (ready.load(std::memory_order_acquire) < Readers)
+                std::this_thread::yield();
+            for (uint32_t i = 0; i < OpsPerWriter; i++) {
+                if (!owned.empty() && (owned.size() == DriversPerWriter || random() % 4 == 0)) {
+                    size_t index = random() % owned.size();
+                    // Only this writer removes its drivers, so the pointer is still live
+                    CHECK(registry.remove(owned[index]));
+                    owned[index] = owned.back();
+                    owned.pop_back();
+                    removes.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    auto driver = new AsusHIDDriver;
+                    if (registry.add(driver)) {
+                        owned.push_back(driver);
+                        adds.fetch_add(1, std::memory_order_relaxed);
+                    } else {
+                        rejected.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    // The registry keeps the only reference
+                    driver->release();
+                }
+                // Let readers in between updates, also on a single core
+                if ((i & 15) == 0)
+                    std::this_thread::yield();
+            }
+            for (auto driver : owned) {
+                CHECK(registry.remove(driver));
+                removes.fetch_add(1, std::memory_order_relaxed);
+            }
+            running.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    for (auto &thread : writers)
+        thread.join();
+    for (auto &thread : readers)
+        thread.join();
+
+    printf("adds %u, rejected %u, removes %u, reader visits %llu\n",
+           adds.load(), rejected.load(), removes.load(), static_cast<unsigned long long>(visits.load()));
+    CHECK_EQ(adds.load(), removes.load());
+    CHECK(visits.load() > 0);
+
+    // Every driver was released exactly once it left both copies
+    uint32_t left = 0;
+    registry.forEach([&left](AsusHIDDriver *driver) { left++; });
+    CHECK_EQ(left, 0);
+    CHECK_EQ(AsusHIDDriver::liveCount(), 0);
+
+    registry.deinit();
+    return 0;
+}
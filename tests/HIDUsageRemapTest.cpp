@@ -0,0 +1,62 @@
+//
+//  HIDUsageRemapTest.cpp
+//  AsusSMC host tests
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#include <initializer_list>
+#include <IOKit/hid/IOHIDUsageTables.h>
+#include "HIDUsageRemap.hpp"
+#include "TestSupport.hpp"
+
+/**
+ *  Checks what AsusHIDDriver::dispatchKeyboardEvent gets from the remap table,
+ *  including 16-bit usages that do not fit the 8-bit table.
+ */
+
+static void checkKnownUsages() {
+    const HIDRemapTable &table = DefaultHIDRemapTable;
+
+    auto sleep = table.lookup(kHIDPage_AsusVendor, kHIDUsage_AsusVendor_Sleep);
+    CHECK(sleep && sleep->accept);
+    CHECK(sleep->kind == HIDRemapKind::Message);
+    CHECK(sleep->message == HIDRemapMessage::Sleep);
+
+    auto brightness = table.lookup(kHIDPage_AsusVendor, kHIDUsage_AsusVendor_BrightnessUp);
+    CHECK(brightness && brightness->kind == HIDRemapKind::Remap);
+    CHECK_EQ(brightness->targetPage, kHIDPage_AppleVendorTopCase);
+    CHECK_EQ(brightness->targetUsage, kHIDUsage_AV_TopCase_BrightnessUp);
+
+    auto rog = table.lookup(kHIDPage_AsusVendor, kHIDUsage_AsusVendor_ROG);
+    CHECK(rog && rog->accept && rog->kind == HIDRemapKind::Drop);
+
+    auto camera = table.lookup(kHIDPage_MicrosoftVendor, kHIDUsage_MicrosoftVendor_Camera);
+    CHECK(camera && camera->accept && camera->kind == HIDRemapKind::Pass);
+
+    CHECK(!table.lookup(kHIDPage_KeyboardOrKeypad, kHIDUsage_KeyboardA));
+}
+
+static void checkOutOfRange() {
+    const HIDRemapTable &table = DefaultHIDRemapTable;
+
+    // Unknown Asus usages are swallowed whatever their width
+    for (uint32_t usage : {0xFFu, 0x100u, 0x1234u, 0xFFFFu}) {
+        auto remap = table.lookup(kHIDPage_AsusVendor, usage);
+        CHECK(remap && !remap->accept);
+        CHECK(remap->kind == HIDRemapKind::Drop);
+    }
+
+    // Unknown Microsoft usages go to IOHIDEventDriver unchanged
+    for (uint32_t usage : {0x00u, 0x100u, 0xFFFFu}) {
+        auto remap = table.lookup(kHIDPage_MicrosoftVendor, usage);
+        CHECK(remap && !remap->accept);
+        CHECK(remap->kind == HIDRemapKind::Pass);
+    }
+}
+
+int main() {
+    checkKnownUsages();
+    checkOutOfRange();
+    return 0;
+}
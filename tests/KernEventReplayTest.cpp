@@ -0,0 +1,192 @@
+//
+//  KernEventReplayTest.cpp
+//  AsusSMC host tests
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#include <thread>
+#include <vector>
+#include "KernEventServer.hpp"
+#include "TestSupport.hpp"
+
+/**
+ *  Replays a recorded session through KernEventServer and decodes the kernel
+ *  events it posts with the same AsusSMCEventDecode the daemon uses.
+ */
+
+struct Message {
+    uint64_t ms;
+    uint32_t type;
+    int32_t x;
+    int32_t y;
+};
+
+struct Frame {
+    AsusSMCEventHeader header;
+    std::vector<AsusSMCEventRecord> records;
+};
+
+/**
+ *  Records further apart than this never share a kernel event
+ */
+static constexpr uint64_t SeparateMS {50};
+
+static std::vector<Message> loadTrace(const char *name) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", ASUSSMC_TRACE_DIR, name);
+    FILE *file = fopen(path, "r");
+    CHECK(file != nullptr);
+
+    std::vector<Message> trace;
+    char line[128];
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long long ms;
+        unsigned type;
+        int x, y;
+        if (line[0] != '#' && sscanf(line, "%llu %u %d %d", &ms, &type, &x, &y) == 4)
+            trace.push_back({ms, type, x, y});
+    }
+    fclose(file);
+    CHECK(!trace.empty());
+    return trace;
+}
+
+/**
+ *  Split what the daemon would recv into kernel events and decode them
+ */
+static std::vector<Frame> readFrames(u_int32_t vendorID) {
+    static uint32_t buffer[1024];
+    std::vector<Frame> frames;
+    size_t length;
+    while ((length = mock_kev_read(buffer, sizeof(buffer))) > 0) {
+        auto bytes = reinterpret_cast<const char *>(buffer);
+        size_t offset = 0;
+        while (length - offset >= KEV_MSG_HEADER_SIZE) {
+            auto message = reinterpret_cast<const kern_event_msg *>(bytes + offset);
+            CHECK(message->total_size >= KEV_MSG_HEADER_SIZE && message->total_size <= length - offset);
+            CHECK_EQ(message->vendor_code, vendorID);
+            CHECK_EQ(message->kev_class, AsusSMCEventClass);
+            CHECK_EQ(message->kev_subclass, AsusSMCEventSubclass);
+            CHECK_EQ(message->event_code, AsusSMCEventCode);
+
+            const AsusSMCEventHeader *header;
+            const AsusSMCEventRecord *records;
+            CHECK_EQ(AsusSMCEventDecode(&message->event_data[0], message->total_size - KEV_MSG_HEADER_SIZE, &header, &records),
+                     AsusSMCEventDecodeOK);
+            frames.push_back({*header, std::vector<AsusSMCEventRecord>(records, records + header->count)});
+            offset += message->total_size;
+        }
+        CHECK_EQ(offset, length);
+    }
+    return frames;
+}
+
+static void waitForFlush() {
+    IOSleep(KernEventServer::BatchWindowUS / 1000 + 20);
+}
+
+static void checkDecoder() {
+    uint8_t payload[AsusSMCEventSize(AsusSMCEventMaxRecords + 1)] {};
+    auto header = reinterpret_cast<AsusSMCEventHeader *>(payload);
+    const AsusSMCEventHeader *decoded;
+    const AsusSMCEventRecord *records;
+
+    CHECK_EQ(AsusSMCEventDecode(payload, sizeof(AsusSMCEventHeader) - 1, &decoded, &records), AsusSMCEventDecodeShort);
+    CHECK_EQ(AsusSMCEventDecode(payload, sizeof(payload), &decoded, &records), AsusSMCEventDecodeVersion);
+
+    header->version = AsusSMCEventVersion;
+    header->count = 2;
+    CHECK_EQ(AsusSMCEventDecode(payload, AsusSMCEventSize(1), &decoded, &records), AsusSMCEventDecodeShort);
+    CHECK_EQ(AsusSMCEventDecode(payload, AsusSMCEventSize(2), &decoded, &records), AsusSMCEventDecodeOK);
+    CHECK(reinterpret_cast<const uint8_t *>(records) == payload + sizeof(AsusSMCEventHeader));
+
+    header->count = AsusSMCEventMaxRecords + 1;
+    CHECK_EQ(AsusSMCEventDecode(payload, sizeof(payload), &decoded, &records), AsusSMCEventDecodeShort);
+}
+
+static void checkWindow(KernEventServer &server, u_int32_t vendorID) {
+    // Nothing is posted before the window closes
+    uint32_t posts = mock_kev_post_count();
+    CHECK(server.sendMessage(kevTouchpad, 1, 0));
+    CHECK(server.sendMessage(kevTouchpad, 0, 0));
+    CHECK_EQ(mock_kev_post_count(), posts);
+    waitForFlush();
+    CHECK_EQ(mock_kev_post_count(), posts + 1);
+
+    auto frames = readFrames(vendorID);
+    CHECK_EQ(frames.size(), 1);
+    CHECK_EQ(frames[0].header.count, 2);
+    CHECK_EQ(frames[0].records[1].seq, frames[0].records[0].seq + 1);
+
+    // A full batch does not wait for the window
+    for (int i = 0; i < AsusSMCEventMaxRecords; i++)
+        CHECK(server.sendMessage(kevKeyboardBacklight, i, 16));
+    CHECK_EQ(mock_kev_post_count(), posts + 2);
+    frames = readFrames(vendorID);
+    CHECK_EQ(frames.size(), 1);
+    CHECK_EQ(frames[0].header.count, AsusSMCEventMaxRecords);
+    uint32_t lost = frames[0].records[AsusSMCEventMaxRecords - 1].seq + 1;
+
+    // Failed posts are reported by the next event and leave a sequence gap
+    mock_kev_fail_posts(1);
+    CHECK(server.sendMessage(kevSleep, 0, 0));
+    waitForFlush();
+    CHECK(server.sendMessage(kevSleep, 0, 0));
+    waitForFlush();
+    frames = readFrames(vendorID);
+    CHECK_EQ(frames.size(), 1);
+    CHECK_EQ(frames[0].header.dropped, 1);
+    CHECK_EQ(frames[0].records[0].seq, lost + 1);
+}
+
+static void checkReplay(KernEventServer &server, u_int32_t vendorID) {
+    auto trace = loadTrace("kev_session.trace");
+
+    auto start = std::chrono::steady_clock::now();
+    for (const auto &message : trace) {
+        std::this_thread::sleep_until(start + std::chrono::milliseconds(message.ms));
+        CHECK(server.sendMessage(message.type, message.x, message.y));
+    }
+    waitForFlush();
+
+    auto frames = readFrames(vendorID);
+    size_t next = 0;
+    uint32_t seq = frames.empty() ? 0 : frames[0].records[0].seq;
+    for (const auto &frame : frames) {
+        CHECK(frame.header.count > 0 && frame.header.count <= AsusSMCEventMaxRecords);
+        for (const auto &record : frame.records) {
+            // Every record arrives once, in order
+            CHECK(next < trace.size());
+            CHECK_EQ(record.seq, seq++);
+            CHECK_EQ(record.type, trace[next].type);
+            CHECK_EQ(record.x, trace[next].x);
+            CHECK_EQ(record.y, trace[next].y);
+            CHECK(record.timestamp >= frame.records[0].timestamp);
+            next++;
+        }
+        uint64_t first = trace[next - frame.header.count].ms;
+        CHECK(trace[next - 1].ms - first < SeparateMS);
+    }
+    CHECK_EQ(next, trace.size());
+
+    printf("%zu records in %zu kernel events\n", trace.size(), frames.size());
+    CHECK(frames.size() < trace.size());
+}
+
+int main() {
+    checkDecoder();
+
+    KernEventServer server;
+    CHECK(server.init());
+    CHECK(server.setVendorID(AsusSMCVendor));
+    server.setEventCode(AsusSMCEventCode);
+    u_int32_t vendorID;
+    CHECK_EQ(kev_vendor_code_find(AsusSMCVendor, &vendorID), KERN_SUCCESS);
+
+    checkWindow(server, vendorID);
+    checkReplay(server, vendorID);
+
+    server.deinit();
+    return 0;
+}
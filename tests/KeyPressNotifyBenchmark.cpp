@@ -0,0 +1,115 @@
+//
+//  KeyPressNotifyBenchmark.cpp
+//  AsusSMC host tests
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#include <vector>
+#include "KeyPressFilter.hpp"
+#include "TestSupport.hpp"
+
+/**
+ *  Per-keystroke cost of forwarding key presses to touchpad drivers
+ *  (kKeyPressed), measured over a typing stream with and without it:
+ *  AsusHIDDriver filters and rate limits every keyboard event, the presses
+ *  it forwards go through the AsusSMC limiter and mark a notification.
+ */
+
+struct KeyEvent {
+    uint64_t timestamp;
+    uint32_t usagePage;
+    uint32_t usage;
+    uint32_t value;
+};
+
+/**
+ *  Fast typing: a key down and up every 40 ms, every fourth key shifted
+ */
+static std::vector<KeyEvent> makeTypingStream(uint32_t keys) {
+    std::vector<KeyEvent> events;
+    uint64_t now = 1000000000ULL;
+    for (uint32_t i = 0; i < keys; i++) {
+        uint32_t usage = kHIDUsage_KeyboardA + i % 26;
+        bool shifted = i % 4 == 0;
+        if (shifted)
+            events.push_back({now, kHIDPage_KeyboardOrKeypad, kHIDUsage_KeyboardLeftShift, 1});
+        events.push_back({now + 1000000, kHIDPage_KeyboardOrKeypad, usage, 1});
+        events.push_back({now + 20000000, kHIDPage_KeyboardOrKeypad, usage, 0});
+        if (shifted)
+            events.push_back({now + 21000000, kHIDPage_KeyboardOrKeypad, kHIDUsage_KeyboardLeftShift, 0});
+        now += 40000000;
+    }
+    return events;
+}
+
+struct Forwarder {
+    KeyPressLimiter hidLimiter;
+    KeyPressLimiter smcLimiter;
+    _Atomic(uint32_t) pendingNotifications = ATOMIC_VAR_INIT(0);
+    uint32_t forwarded {0};
+    uint32_t notified {0};
+
+    /**
+     *  AsusHIDDriver::notifyKeyPress, then AsusSMC::notifyKeyPress up to queueNotification
+     */
+    void keyboardEvent(const KeyEvent &event) {
+        if (!isTypingKeyPress(event.usagePage, event.usage, event.value) || !hidLimiter.admit(event.timestamp))
+            return;
+        forwarded++;
+        if (!smcLimiter.admit(event.timestamp))
+            return;
+        notified++;
+        atomic_fetch_or_explicit(&pendingNotifications, 1U << 1, memory_order_release);
+    }
+};
+
+static void checkFilter() {
+    CHECK(isTypingKeyPress(kHIDPage_KeyboardOrKeypad, kHIDUsage_KeyboardA, 1));
+    CHECK(!isTypingKeyPress(kHIDPage_KeyboardOrKeypad, kHIDUsage_KeyboardA, 0));
+    CHECK(!isTypingKeyPress(kHIDPage_KeyboardOrKeypad, kHIDUsage_KeyboardLeftControl, 1));
+    CHECK(!isTypingKeyPress(kHIDPage_KeyboardOrKeypad, kHIDUsage_KeyboardRightGUI, 1));
+    CHECK(!isTypingKeyPress(kHIDPage_Consumer, kHIDUsage_KeyboardA, 1));
+
+    const uint64_t interval = KeyPressNotifyIntervalMS * 1000000ULL;
+    KeyPressLimiter limiter;
+    CHECK(limiter.admit(interval));
+    CHECK(!limiter.admit(interval));
+    CHECK(!limiter.admit(2 * interval - 1));
+    CHECK(limiter.admit(2 * interval));
+    // Timestamps from another clock domain going backwards are not held back
+    CHECK(limiter.admit(interval / 2));
+}
+
+int main() {
+    checkFilter();
+
+    auto stream = makeTypingStream(1000);
+    uint64_t span = stream.back().timestamp - stream.front().timestamp;
+
+    Forwarder forwarder;
+    for (const auto &event : stream)
+        forwarder.keyboardEvent(event);
+    // Every key down is 40 ms from the last one, so every other one is forwarded
+    CHECK_EQ(forwarder.forwarded, 500);
+    CHECK_EQ(forwarder.notified, forwarder.forwarded);
+    CHECK(forwarder.forwarded <= span / (KeyPressNotifyIntervalMS * 1000000ULL) + 1);
+
+    unsigned long iterations = benchIterations(200);
+    double before = benchmark("keyboard events, no key press notify", iterations, [&](unsigned long i) {
+        for (const auto &event : stream)
+            doNotOptimize(event);
+    });
+    double after = benchmark("keyboard events, key press notify", iterations, [&](unsigned long i) {
+        // A fresh forwarder per pass so every pass forwards the same presses
+        Forwarder pass;
+        for (const auto &event : stream) {
+            doNotOptimize(event);
+            pass.keyboardEvent(event);
+        }
+        doNotOptimize(pass.notified);
+    });
+    printf("%zu events per pass, notify adds %.2f ns per keyboard event\n",
+           stream.size(), (after - before) / stream.size());
+    return 0;
+}
@@ -0,0 +1,198 @@
+//
+//  KeyRepeatBenchmark.cpp
+//  AsusSMC host tests
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#include "BacklightLevels.hpp"
+#include "HIDReport.hpp"
+#include "HIDUsageTables.h"
+#include "PanelBacklight.hpp"
+#include "TestSupport.hpp"
+#include "VirtualHIDKeyboard.hpp"
+
+/**
+ *  Wall-clock cost of a full Fn+F7 off/on cycle the way displayOff runs it:
+ *  one direct brightness set per toggle on the backlight display, against
+ *  emulating brightness keys through VirtualHIDKeyboard when there is none.
+ */
+
+/**
+ *  AppleBacklightDisplay stand-in, applies brightness set through setProperties
+ */
+class MockBacklightDisplay : public IOService {
+public:
+    MockBacklightDisplay(uint32_t value, uint32_t min, uint32_t max) {
+        auto brightness = OSDictionary::withCapacity(3);
+        current = OSNumber::withNumber(value, 32);
+        auto minimum = OSNumber::withNumber(min, 32);
+        auto maximum = OSNumber::withNumber(max, 32);
+        brightness->setObject("value", current);
+        brightness->setObject("min", minimum);
+        brightness->setObject("max", maximum);
+        minimum->release();
+        maximum->release();
+
+        auto parameters = OSDictionary::withCapacity(1);
+        parameters->setObject("brightness", brightness);
+        setProperty("IODisplayParameters", parameters);
+        brightness->release();
+        parameters->release();
+    }
+
+    IOReturn setProperties(OSObject *properties) override {
+        auto params = OSDynamicCast(OSDictionary, properties);
+        auto value = params ? OSDynamicCast(OSNumber, params->getObject("brightness")) : nullptr;
+        if (!value)
+            return kIOReturnBadArgument;
+        current->setValue(value->unsigned32BitValue());
+        writes++;
+        return kIOReturnSuccess;
+    }
+
+    uint32_t brightness() const { return current->unsigned32BitValue(); }
+
+    uint32_t writes {0};
+
+protected:
+    void free() override {
+        current->release();
+        IOService::free();
+    }
+
+private:
+    OSNumber *current {nullptr};
+};
+
+/**
+ *  dispatchTCReport
+ */
+static void dispatchTCReport(VirtualHIDKeyboard *keyboard, key_bitmap &keys, apple_vendor_top_case_input &report, int code, uint32_t loop) {
+    keys.insert(code);
+    keys.serialize(report.keys);
+    apple_vendor_top_case_input press = report;
+    keys.erase(code);
+    keys.serialize(report.keys);
+    keyboard->postKeyRepeat(&press, &report, sizeof(report), loop);
+}
+
+/**
+ *  displayOff, pressed twice
+ */
+static void toggleCycle(PanelBacklight &panel, IOService *display, bool direct,
+                        VirtualHIDKeyboard *keyboard, key_bitmap &keys, apple_vendor_top_case_input &report) {
+    if (!panel.turnOff(display, direct))
+        dispatchTCReport(keyboard, keys, report, kHIDUsage_AV_TopCase_BrightnessDown, PanelBrightnessSteps);
+    if (!panel.turnOn(display, direct))
+        dispatchTCReport(keyboard, keys, report, kHIDUsage_AV_TopCase_BrightnessUp, panel.restoreSteps());
+}
+
+/**
+ *  Checks below return how many reports they posted and cleared
+ */
+static uint32_t checkKeyRepeat(VirtualHIDKeyboard *keyboard) {
+    key_bitmap keys;
+    apple_vendor_top_case_input press, release;
+    keys.insert(kHIDUsage_AV_TopCase_BrightnessDown);
+    keys.serialize(press.keys);
+    keys.erase(kHIDUsage_AV_TopCase_BrightnessDown);
+    keys.serialize(release.keys);
+
+    // Reports arrive in order, press then release, count times
+    CHECK_EQ(keyboard->postKeyRepeat(&press, &release, sizeof(press), 3), kIOReturnSuccess);
+    auto reports = keyboard->copyReports();
+    CHECK_EQ(reports.size(), 6);
+    for (size_t i = 0; i < reports.size(); i++) {
+        CHECK_EQ(reports[i].size(), sizeof(press));
+        CHECK_EQ(reports[i][0], 2);
+        CHECK_EQ(reports[i][1], i % 2 ? 0 : kHIDUsage_AV_TopCase_BrightnessDown);
+    }
+    CHECK_EQ(keyboard->postKeyRepeat(nullptr, &release, sizeof(press), 1), kIOReturnBadArgument);
+    keyboard->clearReports();
+    return static_cast<uint32_t>(reports.size());
+}
+
+static uint32_t checkToggle(VirtualHIDKeyboard *keyboard) {
+    key_bitmap keys;
+    apple_vendor_top_case_input report;
+    auto display = new MockBacklightDisplay(640, 0, 1024);
+
+    // Direct: one write per toggle, brightness comes back, no key presses
+    PanelBacklight panel;
+    CHECK(panel.turnOff(display, true));
+    CHECK(!panel.isOn());
+    CHECK_EQ(display->brightness(), 0);
+    CHECK(panel.turnOn(display, true));
+    CHECK(panel.isOn());
+    CHECK_EQ(display->brightness(), 640);
+    CHECK_EQ(display->writes, 2);
+    CHECK_EQ(keyboard->handledReportCount(), 0);
+
+    // Brightness keys changed the level while off, nothing to restore
+    panel.turnOff(display, true);
+    panel.brightnessChanged();
+    CHECK(panel.isOn());
+    CHECK(!panel.turnOn(display, true));
+
+    // Keystrokes: all the way down, then back up to the saved level
+    PanelBacklight keyed;
+    auto keyedDisplay = new MockBacklightDisplay(640, 0, 1024);
+    toggleCycle(keyed, keyedDisplay, false, keyboard, keys, report);
+    CHECK_EQ(keyedDisplay->writes, 0);
+    auto reports = keyboard->copyReports();
+    CHECK_EQ(reports.size(), (PanelBrightnessSteps + panelBrightnessToSteps(640)) * 2);
+    CHECK_EQ(reports[0][1], kHIDUsage_AV_TopCase_BrightnessDown);
+    CHECK_EQ(reports.back()[1], 0);
+    CHECK_EQ(reports[reports.size() - 2][1], kHIDUsage_AV_TopCase_BrightnessUp);
+    keyboard->clearReports();
+
+    keyedDisplay->release();
+    display->release();
+    return static_cast<uint32_t>(reports.size());
+}
+
+int main() {
+    auto keyboard = new VirtualHIDKeyboard;
+    CHECK(keyboard->init());
+    CHECK(keyboard->start(nullptr));
+
+    uint32_t checked = checkKeyRepeat(keyboard);
+    checked += checkToggle(keyboard);
+    keyboard->recordReports = false;
+    uint64_t handledBefore = keyboard->handledReportCount();
+
+    auto display = new MockBacklightDisplay(640, 0, 1024);
+    key_bitmap keys;
+    apple_vendor_top_case_input report;
+    PanelBacklight direct, keyed;
+
+    unsigned long iterations = benchIterations(20000);
+    double directCycle = benchmark("Fn+F7 off/on, direct set", iterations, [&](unsigned long i) {
+        toggleCycle(direct, display, true, keyboard, keys, report);
+    });
+    CHECK_EQ(keyboard->handledReportCount(), handledBefore);
+    CHECK_EQ(display->writes, 2 * iterations);
+
+    double keyedCycle = benchmark("Fn+F7 off/on, brightness keys", iterations, [&](unsigned long i) {
+        toggleCycle(keyed, display, false, keyboard, keys, report);
+    });
+    uint64_t reportsPerCycle = (PanelBrightnessSteps + panelBrightnessToSteps(640)) * 2;
+    CHECK_EQ(keyboard->handledReportCount() - handledBefore, reportsPerCycle * iterations);
+    printf("per cycle: direct 2 display writes, keys %llu reports, keys vs direct %.2fx\n",
+           static_cast<unsigned long long>(reportsPerCycle), keyedCycle / directCycle);
+
+    // Counters reach the registry from the statistics timer, not from serialization
+    IOSleep(StatPublisher::IntervalMS + 250);
+    auto stats = OSDynamicCast(OSDictionary, keyboard->copyProperty("ReportRingStatistics"));
+    CHECK(stats);
+    auto posted = OSDynamicCast(OSNumber, stats->getObject("ReportsPosted"));
+    CHECK(posted);
+    CHECK_EQ(posted->unsigned32BitValue(), checked + keyboard->handledReportCount());
+    stats->release();
+
+    display->release();
+    keyboard->stop(nullptr);
+    keyboard->release();
+    return 0;
+}
@@ -0,0 +1,66 @@
+//
+//  TestSupport.hpp
+//  AsusSMC host tests
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef TestSupport_hpp
+#define TestSupport_hpp
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ *  Minimal check and timing helpers shared by the host tests and benchmarks.
+ *  A failed check prints its location and exits non-zero so ctest reports it.
+ */
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+    auto _a = (a); auto _b = (b); \
+    if (!(_a == _b)) { \
+        fprintf(stderr, "%s:%d: CHECK_EQ failed: %s == %s (%lld vs %lld)\n", __FILE__, __LINE__, #a, #b, \
+                static_cast<long long>(_a), static_cast<long long>(_b)); \
+        exit(1); \
+    } \
+} while (0)
+
+/**
+ *  Keep value alive so the optimizer cannot drop the benchmarked work
+ */
+template <typename T>
+inline void doNotOptimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ *  Iterations are scaled by ASUSSMC_BENCH_SCALE (default 1) so CI stays fast
+ */
+inline unsigned long benchIterations(unsigned long base) {
+    const char *scale = getenv("ASUSSMC_BENCH_SCALE");
+    unsigned long factor = scale ? strtoul(scale, nullptr, 10) : 1;
+    return base * (factor ? factor : 1);
+}
+
+/**
+ *  Run function iterations times and print the mean cost per call
+ */
+template <typename F>
+inline double benchmark(const char *name, unsigned long iterations, F function) {
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+        function(i);
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    double perCall = elapsed / iterations;
+    printf("%-40s %12lu iterations %10.1f ns/op\n", name, iterations, perCall);
+    return perCall;
+}
+
+#endif /* TestSupport_hpp */
@@ -0,0 +1,46 @@
+//
+//  AsusHIDDriver.hpp
+//  AsusSMC host mock
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef MOCK_AsusHIDDriver_hpp
+#define MOCK_AsusHIDDriver_hpp
+
+#include <atomic>
+#include <IOKit/IOService.h>
+
+/**
+ *  Stand-in for the HID driver, counts live instances so registry tests
+ *  can check every retain is matched by a release
+ */
+class AsusHIDDriver : public IOService {
+public:
+    AsusHIDDriver() { live.fetch_add(1, std::memory_order_relaxed); }
+    ~AsusHIDDriver() override {
+        magic.store(0, std::memory_order_relaxed);
+        live.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    const char *getName() const override { return "AsusHIDDriver"; }
+
+    void setKeyboardBacklight(uint8_t val) { backlight.store(val, std::memory_order_relaxed); }
+    uint8_t keyboardBacklight() const { return backlight.load(std::memory_order_relaxed); }
+
+    /**
+     *  False once destroyed, for catching readers of released drivers
+     */
+    bool isAlive() const { return magic.load(std::memory_order_relaxed) == Magic && getRetainCount() > 0; }
+
+    static int liveCount() { return live.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr uint32_t Magic {0x48494444};
+
+    std::atomic<uint32_t> magic {Magic};
+    std::atomic<uint8_t> backlight {0};
+    static inline std::atomic<int> live {0};
+};
+
+#endif /* MOCK_AsusHIDDriver_hpp */
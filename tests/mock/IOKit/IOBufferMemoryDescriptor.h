@@ -0,0 +1,51 @@
+//
+//  IOBufferMemoryDescriptor.h
+//  AsusSMC host mock
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef MOCK_IOBufferMemoryDescriptor_h
+#define MOCK_IOBufferMemoryDescriptor_h
+
+#include <vector>
+#include <IOKit/IOService.h>
+
+enum IODirection {
+    kIODirectionNone = 0,
+    kIODirectionIn   = 1,
+    kIODirectionOut  = 2,
+};
+
+class IOMemoryDescriptor : public OSObject {
+public:
+    virtual IOByteCount getLength() const = 0;
+    virtual const void *getBytes() const = 0;
+};
+
+class IOBufferMemoryDescriptor : public IOMemoryDescriptor {
+public:
+    static IOBufferMemoryDescriptor *withBytes(const void *bytes, IOByteCount length, IODirection direction) {
+        auto buffer = new IOBufferMemoryDescriptor;
+        buffer->data.assign(static_cast<const uint8_t *>(bytes), static_cast<const uint8_t *>(bytes) + length);
+        return buffer;
+    }
+
+    static IOBufferMemoryDescriptor *withCapacity(IOByteCount capacity, IODirection direction, bool contiguous = false) {
+        auto buffer = new IOBufferMemoryDescriptor;
+        buffer->data.reserve(capacity);
+        buffer->data.resize(capacity);
+        return buffer;
+    }
+
+    void *getBytesNoCopy() { return data.data(); }
+    // Capacity was reserved up front, so shrinking and growing back never reallocates
+    void setLength(IOByteCount length) { data.resize(length); }
+    IOByteCount getLength() const override { return data.size(); }
+    const void *getBytes() const override { return data.data(); }
+
+private:
+    std::vector<uint8_t> data;
+};
+
+#endif /* MOCK_IOBufferMemoryDescriptor_h */
@@ -0,0 +1,65 @@
+//
+//  IOLib.h
+//  AsusSMC host mock
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef MOCK_IOLib_h
+#define MOCK_IOLib_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+
+/**
+ *  Plain C subset of IOKit/IOLib.h and mach time, enough for the portable
+ *  driver sources to build on the host. Time is CLOCK_MONOTONIC in ns,
+ *  so absolute time and nanoseconds are the same unit.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int kern_return_t;
+typedef int IOReturn;
+typedef uint32_t IOOptionBits;
+typedef size_t IOByteCount;
+typedef uint32_t IOItemCount;
+typedef uint8_t UInt8;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef uint64_t UInt64;
+typedef int32_t SInt32;
+
+#define KERN_SUCCESS            0
+#define KERN_FAILURE            5
+
+#define kIOReturnSuccess        0
+#define kIOReturnError          ((IOReturn)0xe00002bc)
+#define kIOReturnNoMemory       ((IOReturn)0xe00002bd)
+#define kIOReturnBadArgument    ((IOReturn)0xe00002c2)
+#define kIOReturnUnsupported    ((IOReturn)0xe00002c7)
+#define kIOReturnNotFound       ((IOReturn)0xe00002f0)
+
+uint64_t mach_absolute_time(void);
+void clock_get_uptime(uint64_t *result);
+void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t *result);
+void nanoseconds_to_absolutetime(uint64_t nanoseconds, uint64_t *result);
+
+void IODelay(unsigned microseconds);
+void IOSleep(unsigned milliseconds);
+void *IOMalloc(size_t size);
+void IOFree(void *address, size_t size);
+
+#define IOLog printf
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MOCK_IOLib_h */
@@ -0,0 +1,29 @@
+//
+//  IOLocks.h
+//  AsusSMC host mock
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef MOCK_IOLocks_h
+#define MOCK_IOLocks_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  IOLock backed by a pthread mutex
+ */
+typedef struct IOLock IOLock;
+
+IOLock *IOLockAlloc(void);
+void IOLockFree(IOLock *lock);
+void IOLockLock(IOLock *lock);
+void IOLockUnlock(IOLock *lock);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MOCK_IOLocks_h */
@@ -0,0 +1,203 @@
+//
+//  IOService.h
+//  AsusSMC host mock
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef MOCK_IOService_h
+#define MOCK_IOService_h
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <IOKit/IOLib.h>
+
+/**
+ *  libkern metaclass macros, RTTI does the job on the host
+ */
+#define OSDeclareDefaultStructors(className)
+#define OSDefineMetaClassAndStructors(className, superclassName)
+#define OSDynamicCast(type, inst) dynamic_cast<type *>(inst)
+
+/**
+ *  Reference counted OSObject, freed on the last release
+ */
+class OSObject {
+public:
+    virtual ~OSObject() = default;
+
+    void retain() const { retainCount.fetch_add(1, std::memory_order_relaxed); }
+
+    void release() const {
+        if (retainCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            const_cast<OSObject *>(this)->free();
+    }
+
+    int getRetainCount() const { return retainCount.load(std::memory_order_relaxed); }
+
+    virtual bool init() { return true; }
+
+protected:
+    virtual void free() { delete this; }
+
+private:
+    mutable std::atomic<int> retainCount {1};
+};
+
+#define OSSafeReleaseNULL(inst) do { if (inst) (inst)->release(); (inst) = nullptr; } while (0)
+
+class OSNumber : public OSObject {
+public:
+    static OSNumber *withNumber(unsigned long long value, unsigned int numberOfBits) {
+        auto number = new OSNumber;
+        number->value = value;
+        return number;
+    }
+
+    void setValue(unsigned long long newValue) { value = newValue; }
+    uint32_t unsigned32BitValue() const { return static_cast<uint32_t>(value); }
+    uint64_t unsigned64BitValue() const { return value; }
+
+private:
+    unsigned long long value {0};
+};
+
+class OSBoolean : public OSObject {
+public:
+    explicit OSBoolean(bool value) : value(value) {}
+    bool isTrue() const { return value; }
+    static OSBoolean *withBoolean(bool value);
+
+protected:
+    // Shared singletons are never freed
+    void free() override {}
+
+private:
+    bool value;
+};
+
+extern OSBoolean *const kOSBooleanTrue;
+extern OSBoolean *const kOSBooleanFalse;
+
+class OSString : public OSObject {
+public:
+    static OSString *withCString(const char *cString) {
+        auto string = new OSString;
+        string->value = cString;
+        return string;
+    }
+
+    const char *getCStringNoCopy() const { return value.c_str(); }
+    bool isEqualTo(const char *cString) const { return value == cString; }
+
+private:
+    std::string value;
+};
+
+/**
+ *  Dictionary keyed by C strings, retains its values
+ */
+class OSDictionary : public OSObject {
+public:
+    static OSDictionary *withCapacity(unsigned int capacity) { return new OSDictionary; }
+
+    bool setObject(const char *key, const OSObject *object) {
+        if (!object)
+            return false;
+        object->retain();
+        auto &slot = objects[key];
+        if (slot)
+            slot->release();
+        slot = object;
+        return true;
+    }
+
+    OSObject *getObject(const char *key) const {
+        auto it = objects.find(key);
+        return it == objects.end() ? nullptr : const_cast<OSObject *>(it->second);
+    }
+
+    unsigned int getCount() const { return static_cast<unsigned int>(objects.size()); }
+
+protected:
+    void free() override {
+        for (auto &entry : objects)
+            entry.second->release();
+        objects.clear();
+        OSObject::free();
+    }
+
+private:
+    std::map<std::string, const OSObject *> objects;
+};
+
+class OSSerialize : public OSObject {};
+
+/**
+ *  Registry entry with a thread-safe property table
+ */
+class IORegistryEntry : public OSObject {
+public:
+    bool setProperty(const char *key, OSObject *object) {
+        std::lock_guard<std::mutex> guard(propertyLock);
+        if (!properties)
+            properties = OSDictionary::withCapacity(1);
+        return properties->setObject(key, object);
+    }
+
+    bool setProperty(const char *key, bool value) {
+        return setProperty(key, value ? kOSBooleanTrue : kOSBooleanFalse);
+    }
+
+    /**
+     *  Retained like copyProperty so tests can hold on to values
+     */
+    OSObject *copyProperty(const char *key) const {
+        std::lock_guard<std::mutex> guard(propertyLock);
+        OSObject *object = properties ? properties->getObject(key) : nullptr;
+        if (object)
+            object->retain();
+        return object;
+    }
+
+    /**
+     *  Not retained, only safe while the property is not replaced
+     */
+    OSObject *getProperty(const char *key) const {
+        std::lock_guard<std::mutex> guard(propertyLock);
+        return properties ? properties->getObject(key) : nullptr;
+    }
+
+    virtual IOReturn setProperties(OSObject *properties) { return kIOReturnUnsupported; }
+
+    virtual bool serializeProperties(OSSerialize *serialize) const { return true; }
+
+protected:
+    void free() override {
+        OSSafeReleaseNULL(properties);
+        OSObject::free();
+    }
+
+private:
+    mutable std::mutex propertyLock;
+    OSDictionary *properties {nullptr};
+};
+
+class IOWorkLoop;
+
+class IOService : public IORegistryEntry {
+public:
+    /**
+     *  All services share one workloop unless they provide their own
+     */
+    virtual IOWorkLoop *getWorkLoop() const;
+
+    virtual const char *getName() const { return "IOService"; }
+    virtual bool attach(IOService *provider) { return true; }
+    virtual bool start(IOService *provider) { return true; }
+    virtual void stop(IOService *provider) {}
+};
+
+#endif /* MOCK_IOService_h */
@@ -0,0 +1,59 @@
+//
+//  IOTimerEventSource.h
+//  AsusSMC host mock
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef MOCK_IOTimerEventSource_h
+#define MOCK_IOTimerEventSource_h
+
+#include <IOKit/IOWorkLoop.h>
+#include <kern/thread_call.h>
+
+/**
+ *  Timer backed by a thread call, the action runs with the workloop gate closed
+ */
+class IOTimerEventSource : public IOEventSource {
+public:
+    typedef void (*Action)(OSObject *owner, IOTimerEventSource *sender);
+
+    static IOTimerEventSource *timerEventSource(OSObject *owner, Action action) {
+        auto timer = new IOTimerEventSource;
+        timer->owner = owner;
+        timer->action = action;
+        timer->call = thread_call_allocate(timeout, timer);
+        return timer;
+    }
+
+    IOReturn setTimeoutMS(uint32_t ms) {
+        uint64_t deadline;
+        clock_interval_to_deadline(ms, kMillisecondScale, &deadline);
+        thread_call_enter_delayed(call, deadline);
+        return kIOReturnSuccess;
+    }
+
+    void cancelTimeout() { thread_call_cancel_wait(call); }
+
+protected:
+    void free() override {
+        thread_call_free(call);
+        OSObject::free();
+    }
+
+private:
+    static void timeout(thread_call_param_t param0, thread_call_param_t) {
+        auto timer = static_cast<IOTimerEventSource *>(param0);
+        IOWorkLoop *workLoop = timer->getWorkLoop();
+        if (!workLoop)
+            return;
+        workLoop->closeGate();
+        timer->action(timer->owner, timer);
+        workLoop->openGate();
+    }
+
+    Action action {nullptr};
+    thread_call_t call {nullptr};
+};
+
+#endif /* MOCK_IOTimerEventSource_h */
@@ -0,0 +1,52 @@
+//
+//  IOWorkLoop.h
+//  AsusSMC host mock
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef MOCK_IOWorkLoop_h
+#define MOCK_IOWorkLoop_h
+
+#include <IOKit/IOService.h>
+
+class IOWorkLoop;
+
+class IOEventSource : public OSObject {
+public:
+    IOWorkLoop *getWorkLoop() const { return workLoop; }
+    virtual void setWorkLoop(IOWorkLoop *inWorkLoop) { workLoop = inWorkLoop; }
+
+protected:
+    OSObject *owner {nullptr};
+    IOWorkLoop *workLoop {nullptr};
+};
+
+/**
+ *  Event sources run one at a time under the workloop gate, there is no
+ *  dedicated thread, actions run on whatever thread fires them.
+ */
+class IOWorkLoop : public OSObject {
+public:
+    static IOWorkLoop *workLoop() { return new IOWorkLoop; }
+
+    IOReturn addEventSource(IOEventSource *source) {
+        source->retain();
+        source->setWorkLoop(this);
+        return kIOReturnSuccess;
+    }
+
+    IOReturn removeEventSource(IOEventSource *source) {
+        source->setWorkLoop(nullptr);
+        source->release();
+        return kIOReturnSuccess;
+    }
+
+    void closeGate() { gate.lock(); }
+    void openGate() { gate.unlock(); }
+
+private:
+    std::recursive_mutex gate;
+};
+
+#endif /* MOCK_IOWorkLoop_h */
@@ -0,0 +1,91 @@
+//
+//  IOACPIPlatformDevice.h
+//  AsusSMC host mock
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef MOCK_IOACPIPlatformDevice_h
+#define MOCK_IOACPIPlatformDevice_h
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <IOKit/IOService.h>
+
+/**
+ *  ACPI device whose methods are host callbacks. Every evaluation is
+ *  recorded with its first integer argument and uptime, so tests can check
+ *  what the driver wrote to the EC and when.
+ */
+class IOACPIPlatformDevice : public IOService {
+public:
+    using Method = std::function<IOReturn(OSObject *params[], UInt32 paramCount, UInt32 *result)>;
+
+    struct Call {
+        std::string method;
+        uint32_t argument;
+        uint64_t timestamp;
+    };
+
+    /**
+     *  Mock control: install method, a method without handler is missing
+     */
+    void setMethod(const char *name, Method method) {
+        std::lock_guard<std::mutex> guard(lock);
+        methods[name] = std::move(method);
+    }
+
+    /**
+     *  Mock control: copy of all evaluations so far
+     */
+    std::vector<Call> calls() {
+        std::lock_guard<std::mutex> guard(lock);
+        return log;
+    }
+
+    void clearCalls() {
+        std::lock_guard<std::mutex> guard(lock);
+        log.clear();
+    }
+
+    IOReturn validateObject(const char *objectName) {
+        std::lock_guard<std::mutex> guard(lock);
+        return methods.count(objectName) ? kIOReturnSuccess : kIOReturnNotFound;
+    }
+
+    IOReturn evaluateInteger(const char *objectName, UInt32 *resultInt32, OSObject *params[] = nullptr, IOItemCount paramCount = 0) {
+        return evaluate(objectName, params, paramCount, resultInt32);
+    }
+
+    IOReturn evaluateObject(const char *objectName, OSObject **result = nullptr, OSObject *params[] = nullptr, IOItemCount paramCount = 0, IOOptionBits options = 0) {
+        UInt32 value = 0;
+        IOReturn ret = evaluate(objectName, params, paramCount, &value);
+        if (result)
+            *result = ret == kIOReturnSuccess ? OSNumber::withNumber(value, 32) : nullptr;
+        return ret;
+    }
+
+private:
+    std::mutex lock;
+    std::map<std::string, Method> methods;
+    std::vector<Call> log;
+
+    IOReturn evaluate(const char *objectName, OSObject *params[], UInt32 paramCount, UInt32 *result) {
+        Method method;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = methods.find(objectName);
+            if (it == methods.end())
+                return kIOReturnNotFound;
+            method = it->second;
+            auto number = paramCount ? dynamic_cast<OSNumber *>(params[0]) : nullptr;
+            log.push_back({objectName, number ? number->unsigned32BitValue() : 0, mach_absolute_time()});
+        }
+        return method(params, paramCount, result);
+    }
+};
+
+#endif /* MOCK_IOACPIPlatformDevice_h */
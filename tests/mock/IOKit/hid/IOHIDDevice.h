@@ -0,0 +1,86 @@
+//
+//  IOHIDDevice.h
+//  AsusSMC host mock
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef MOCK_IOHIDDevice_h
+#define MOCK_IOHIDDevice_h
+
+#include <mutex>
+#include <vector>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/hid/IOHIDUsageTables.h>
+
+enum IOHIDReportType {
+    kIOHIDReportTypeInput = 0,
+    kIOHIDReportTypeOutput,
+    kIOHIDReportTypeFeature,
+};
+
+enum {
+    kIOHIDOptionsTypeNone = 0,
+};
+
+/**
+ *  HID device that keeps every report handed to it.
+ *  Set recordReports to false to only count them.
+ */
+class IOHIDDevice : public IOService {
+public:
+    virtual bool handleStart(IOService *provider) { return true; }
+
+    virtual void handleStop(IOService *provider) {}
+
+    bool start(IOService *provider) override { return handleStart(provider); }
+    void stop(IOService *provider) override { handleStop(provider); }
+
+    virtual OSString *newManufacturerString() const { return nullptr; }
+    virtual OSString *newProductString() const { return nullptr; }
+    virtual OSString *newSerialNumberString() const { return nullptr; }
+    virtual OSNumber *newVendorIDNumber() const { return nullptr; }
+    virtual OSNumber *newProductIDNumber() const { return nullptr; }
+    virtual OSNumber *newLocationIDNumber() const { return nullptr; }
+    virtual OSNumber *newCountryCodeNumber() const { return nullptr; }
+    virtual OSNumber *newPrimaryUsagePageNumber() const { return nullptr; }
+    virtual OSNumber *newPrimaryUsageNumber() const { return nullptr; }
+    virtual IOReturn newReportDescriptor(IOMemoryDescriptor **descriptor) const { return kIOReturnUnsupported; }
+
+    virtual IOReturn handleReport(IOMemoryDescriptor *report, IOHIDReportType reportType = kIOHIDReportTypeInput, IOOptionBits options = 0) {
+        auto bytes = static_cast<const uint8_t *>(report->getBytes());
+        std::lock_guard<std::mutex> guard(lock);
+        reportCount++;
+        if (recordReports)
+            reports.emplace_back(bytes, bytes + report->getLength());
+        return kIOReturnSuccess;
+    }
+
+    /**
+     *  Mock control: copy of all reports so far
+     */
+    std::vector<std::vector<uint8_t>> copyReports() {
+        std::lock_guard<std::mutex> guard(lock);
+        return reports;
+    }
+
+    uint64_t handledReportCount() {
+        std::lock_guard<std::mutex> guard(lock);
+        return reportCount;
+    }
+
+    void clearReports() {
+        std::lock_guard<std::mutex> guard(lock);
+        reports.clear();
+        reportCount = 0;
+    }
+
+    bool recordReports {true};
+
+private:
+    std::mutex lock;
+    std::vector<std::vector<uint8_t>> reports;
+    uint64_t reportCount {0};
+};
+
+#endif /* MOCK_IOHIDDevice_h */
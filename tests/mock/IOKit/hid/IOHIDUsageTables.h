@@ -0,0 +1,30 @@
+//
+//  IOHIDUsageTables.h
+//  AsusSMC host mock
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef MOCK_IOHIDUsageTables_h
+#define MOCK_IOHIDUsageTables_h
+
+/**
+ *  Only the pages and usages the drivers refer to
+ */
+enum {
+    kHIDPage_KeyboardOrKeypad = 0x07,
+    kHIDPage_Consumer = 0x0C,
+};
+
+enum {
+    kHIDUsage_KeyboardA = 0x04,
+    kHIDUsage_KeyboardLeftControl = 0xE0,
+    kHIDUsage_KeyboardLeftShift = 0xE1,
+    kHIDUsage_KeyboardRightGUI = 0xE7,
+};
+
+enum {
+    kHIDUsage_Csmr_ConsumerControl = 0x01,
+};
+
+#endif /* MOCK_IOHIDUsageTables_h */
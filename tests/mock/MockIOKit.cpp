@@ -0,0 +1,259 @@
+//
+//  MockIOKit.cpp
+//  AsusSMC host mock
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <IOKit/IOLib.h>
+#include <IOKit/IOLocks.h>
+#include <IOKit/IOService.h>
+#include <IOKit/IOWorkLoop.h>
+#include <VirtualSMCSDK/kern_vsmcapi.hpp>
+#include <kern/thread_call.h>
+#include <sys/kern_event.h>
+
+uint64_t mach_absolute_time(void) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void clock_get_uptime(uint64_t *result) {
+    *result = mach_absolute_time();
+}
+
+void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t *result) {
+    *result = abstime;
+}
+
+void nanoseconds_to_absolutetime(uint64_t nanoseconds, uint64_t *result) {
+    *result = nanoseconds;
+}
+
+void IODelay(unsigned microseconds) {
+    if (microseconds <= 1)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(microseconds));
+}
+
+void IOSleep(unsigned milliseconds) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+}
+
+void *IOMalloc(size_t size) {
+    return malloc(size);
+}
+
+void IOFree(void *address, size_t size) {
+    free(address);
+}
+
+IOWorkLoop *IOService::getWorkLoop() const {
+    static IOWorkLoop *sharedWorkLoop = IOWorkLoop::workLoop();
+    return sharedWorkLoop;
+}
+
+struct IOLock {
+    std::mutex mutex;
+};
+
+IOLock *IOLockAlloc(void) {
+    return new IOLock;
+}
+
+void IOLockFree(IOLock *lock) {
+    delete lock;
+}
+
+void IOLockLock(IOLock *lock) {
+    lock->mutex.lock();
+}
+
+void IOLockUnlock(IOLock *lock) {
+    lock->mutex.unlock();
+}
+
+struct thread_call {
+    thread_call_func_t func;
+    thread_call_param_t param0;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::thread worker;
+    bool pending {false};
+    bool running {false};
+    bool exiting {false};
+    uint64_t deadline {0};
+
+    void run() {
+        std::unique_lock<std::mutex> guard(mutex);
+        while (true) {
+            if (exiting)
+                return;
+            if (!pending) {
+                wake.wait(guard);
+                continue;
+            }
+            uint64_t now = mach_absolute_time();
+            if (now < deadline) {
+                wake.wait_for(guard, std::chrono::nanoseconds(deadline - now));
+                continue;
+            }
+            pending = false;
+            running = true;
+            guard.unlock();
+            func(param0, nullptr);
+            guard.lock();
+            running = false;
+            idle.notify_all();
+        }
+    }
+};
+
+thread_call_t thread_call_allocate(thread_call_func_t func, thread_call_param_t param0) {
+    auto call = new thread_call;
+    call->func = func;
+    call->param0 = param0;
+    call->worker = std::thread(&thread_call::run, call);
+    return call;
+}
+
+int thread_call_enter(thread_call_t call) {
+    std::lock_guard<std::mutex> guard(call->mutex);
+    bool wasPending = call->pending;
+    if (!wasPending) {
+        call->pending = true;
+        call->deadline = 0;
+        call->wake.notify_one();
+    }
+    return wasPending;
+}
+
+int thread_call_enter_delayed(thread_call_t call, uint64_t deadline) {
+    std::lock_guard<std::mutex> guard(call->mutex);
+    bool wasPending = call->pending;
+    call->pending = true;
+    call->deadline = deadline;
+    call->wake.notify_one();
+    return wasPending;
+}
+
+int thread_call_cancel_wait(thread_call_t call) {
+    std::unique_lock<std::mutex> guard(call->mutex);
+    bool wasPending = call->pending;
+    call->pending = false;
+    call->idle.wait(guard, [call] { return !call->running; });
+    return wasPending;
+}
+
+int thread_call_free(thread_call_t call) {
+    {
+        std::lock_guard<std::mutex> guard(call->mutex);
+        call->exiting = true;
+        call->wake.notify_one();
+    }
+    call->worker.join();
+    delete call;
+    return true;
+}
+
+void clock_interval_to_deadline(uint32_t interval, uint32_t scale_factor, uint64_t *result) {
+    *result = mach_absolute_time() + static_cast<uint64_t>(interval) * scale_factor;
+}
+
+namespace {
+    std::mutex kevLock;
+    std::vector<uint8_t> kevFrames;
+    uint32_t kevPosts {0};
+    uint32_t kevFailures {0};
+}
+
+int kev_vendor_code_find(const char *vendor_string, u_int32_t *vendor_code) {
+    // Stable per string, like the kernel's vendor table
+    uint32_t hash = 2166136261u;
+    for (const char *c = vendor_string; *c; c++)
+        hash = (hash ^ static_cast<uint8_t>(*c)) * 16777619u;
+    *vendor_code = hash | 0x1000;
+    return KERN_SUCCESS;
+}
+
+int kev_msg_post(struct kev_msg *event_msg) {
+    std::lock_guard<std::mutex> guard(kevLock);
+    kevPosts++;
+    if (kevFailures) {
+        kevFailures--;
+        return KERN_FAILURE;
+    }
+
+    kern_event_msg header {};
+    header.total_size = KEV_MSG_HEADER_SIZE;
+    for (int i = 0; i < N_KEV_VECTORS && event_msg->dv[i].data_length; i++)
+        header.total_size += event_msg->dv[i].data_length;
+    header.vendor_code = event_msg->vendor_code;
+    header.kev_class = event_msg->kev_class;
+    header.kev_subclass = event_msg->kev_subclass;
+    header.id = kevPosts;
+    header.event_code = event_msg->event_code;
+
+    auto bytes = reinterpret_cast<const uint8_t *>(&header);
+    kevFrames.insert(kevFrames.end(), bytes, bytes + KEV_MSG_HEADER_SIZE);
+    for (int i = 0; i < N_KEV_VECTORS && event_msg->dv[i].data_length; i++) {
+        auto data = static_cast<const uint8_t *>(event_msg->dv[i].data_ptr);
+        kevFrames.insert(kevFrames.end(), data, data + event_msg->dv[i].data_length);
+    }
+    return KERN_SUCCESS;
+}
+
+size_t mock_kev_read(void *buffer, size_t size) {
+    std::lock_guard<std::mutex> guard(kevLock);
+    size_t copied = 0;
+    while (copied + KEV_MSG_HEADER_SIZE <= kevFrames.size()) {
+        kern_event_msg header;
+        memcpy(&header, kevFrames.data() + copied, KEV_MSG_HEADER_SIZE);
+        if (copied + header.total_size > size)
+            break;
+        copied += header.total_size;
+    }
+    memcpy(buffer, kevFrames.data(), copied);
+    kevFrames.erase(kevFrames.begin(), kevFrames.begin() + copied);
+    return copied;
+}
+
+uint32_t mock_kev_post_count(void) {
+    std::lock_guard<std::mutex> guard(kevLock);
+    return kevPosts;
+}
+
+void mock_kev_fail_posts(uint32_t count) {
+    std::lock_guard<std::mutex> guard(kevLock);
+    kevFailures = count;
+}
+
+namespace {
+    std::atomic<uint32_t> interrupts {0};
+}
+
+bool VirtualSMCAPI::postInterrupt(uint8_t code, const void *data, uint32_t dataSize) {
+    interrupts.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+uint32_t VirtualSMCAPI::mockInterruptCount() {
+    return interrupts.load(std::memory_order_relaxed);
+}
+
+static OSBoolean booleanTrue {true};
+static OSBoolean booleanFalse {false};
+OSBoolean *const kOSBooleanTrue = &booleanTrue;
+OSBoolean *const kOSBooleanFalse = &booleanFalse;
+
+OSBoolean *OSBoolean::withBoolean(bool value) {
+    return value ? kOSBooleanTrue : kOSBooleanFalse;
+}
@@ -0,0 +1,57 @@
+//
+//  kern_vsmcapi.hpp
+//  AsusSMC host mock
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef MOCK_kern_vsmcapi_hpp
+#define MOCK_kern_vsmcapi_hpp
+
+#include <atomic>
+#include <IOKit/IOLib.h>
+
+/**
+ *  The kext uses C11 style atomics from the VirtualSMC SDK, map them to
+ *  std::atomic which has the same free functions.
+ */
+#define _Atomic(T) std::atomic<T>
+using std::memory_order_relaxed;
+using std::memory_order_acquire;
+using std::memory_order_release;
+using std::memory_order_acq_rel;
+using std::memory_order_seq_cst;
+using std::atomic_init;
+using std::atomic_load_explicit;
+using std::atomic_store_explicit;
+using std::atomic_exchange_explicit;
+using std::atomic_fetch_add_explicit;
+using std::atomic_fetch_sub_explicit;
+using std::atomic_fetch_or_explicit;
+using std::atomic_fetch_and_explicit;
+using std::atomic_compare_exchange_weak_explicit;
+using std::atomic_compare_exchange_strong_explicit;
+
+#ifdef ASUSSMC_MOCK_LOG
+#define SYSLOG(module, str, ...) printf("%s: " str "\n", module, ## __VA_ARGS__)
+#define DBGLOG(module, str, ...) printf("%s: " str "\n", module, ## __VA_ARGS__)
+#else
+#define SYSLOG(module, str, ...) do { } while (0)
+#define DBGLOG(module, str, ...) do { } while (0)
+#endif
+
+#define lilu_os_memcpy memcpy
+
+namespace VirtualSMCAPI {
+    /**
+     *  Counts posts instead of raising an SMC interrupt
+     */
+    bool postInterrupt(uint8_t code, const void *data = nullptr, uint32_t dataSize = 0);
+
+    /**
+     *  Mock control: number of postInterrupt calls so far
+     */
+    uint32_t mockInterruptCount();
+}
+
+#endif /* MOCK_kern_vsmcapi_hpp */
@@ -0,0 +1,45 @@
+//
+//  thread_call.h
+//  AsusSMC host mock
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef MOCK_thread_call_h
+#define MOCK_thread_call_h
+
+#include <stdint.h>
+
+/**
+ *  Thread calls run on a private pthread each. Like XNU, entering a call
+ *  that is already pending only moves its deadline.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void *thread_call_param_t;
+typedef void (*thread_call_func_t)(thread_call_param_t param0, thread_call_param_t param1);
+typedef struct thread_call *thread_call_t;
+
+enum {
+    kNanosecondScale  = 1,
+    kMicrosecondScale = 1000,
+    kMillisecondScale = 1000 * 1000,
+    kSecondScale      = 1000 * 1000 * 1000,
+};
+
+thread_call_t thread_call_allocate(thread_call_func_t func, thread_call_param_t param0);
+int thread_call_enter(thread_call_t call);
+int thread_call_enter_delayed(thread_call_t call, uint64_t deadline);
+int thread_call_cancel_wait(thread_call_t call);
+int thread_call_free(thread_call_t call);
+
+void clock_interval_to_deadline(uint32_t interval, uint32_t scale_factor, uint64_t *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MOCK_thread_call_h */
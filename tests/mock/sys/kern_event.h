@@ -0,0 +1,79 @@
+//
+//  kern_event.h
+//  AsusSMC host mock
+//
+//  Copyright © 2019 Le Bao Hiep. All rights reserved.
+//
+
+#ifndef MOCK_kern_event_h
+#define MOCK_kern_event_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ *  Kernel event structures as laid out by XNU. kev_msg_post builds the
+ *  kern_event_msg a PF_SYSTEM socket would deliver and appends it to a
+ *  capture buffer the tests read back with mock_kev_read.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define KEV_ANY_VENDOR                  0
+#define KEV_ANY_CLASS                   0
+#define KEV_ANY_SUBCLASS                0
+#define KEV_VENDOR_CODE_MAX_STR_LEN     200
+#define N_KEV_VECTORS                   5
+
+struct kev_d_vectors {
+    u_int32_t data_length;
+    void *data_ptr;
+};
+
+struct kev_msg {
+    u_int32_t vendor_code;
+    u_int32_t kev_class;
+    u_int32_t kev_subclass;
+    u_int32_t event_code;
+    struct kev_d_vectors dv[N_KEV_VECTORS];
+};
+
+struct kern_event_msg {
+    u_int32_t total_size;
+    u_int32_t vendor_code;
+    u_int32_t kev_class;
+    u_int32_t kev_subclass;
+    u_int32_t id;
+    u_int32_t event_code;
+    u_int32_t event_data[1];
+};
+
+#define KEV_MSG_HEADER_SIZE (offsetof(struct kern_event_msg, event_data[0]))
+
+int kev_vendor_code_find(const char *vendor_string, u_int32_t *vendor_code);
+int kev_msg_post(struct kev_msg *event_msg);
+
+/**
+ *  Mock control: drain up to size bytes of captured frames, returns bytes copied.
+ *  Frames are never split, like a PF_SYSTEM recv.
+ */
+size_t mock_kev_read(void *buffer, size_t size);
+
+/**
+ *  Mock control: number of kev_msg_post calls so far
+ */
+uint32_t mock_kev_post_count(void);
+
+/**
+ *  Mock control: fail the next count posts
+ */
+void mock_kev_fail_posts(uint32_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MOCK_kern_event_h */